@@ -47,6 +47,11 @@ DEFAULTS = {
             'empty_group_count': 1,
             'row_queue_capacity': 255,
             'parser_threads': 6,
+            'row_cache': False,
+            'row_cache_bytes': 5e8,
+            'spin_count': 256,
+            'row_batch_size': 1,
+            'parallel': False,
         },
         'hyper': {
             'run': True,
@@ -58,6 +63,10 @@ DEFAULTS = {
             'row_queue_capacity': 255,
             'parser_threads': 6,
             'score_parallel': True,
+            'spin_count': 256,
+            'row_batch_size': 1,
+            'kind_threads': 0,
+            'row_parallel': False,
         },
     },
     'posterior_enum': {
@@ -71,6 +80,11 @@ DEFAULTS = {
     },
     'query': {
         'parallel': True,
+        'threads': 1,
+        'ordered': True,
+    },
+    'rows': {
+        'readahead_depth': 0,
     },
 }
 
@@ -89,9 +103,10 @@ def fill_in_sequential(config):
     fill_in_defaults(config)
     kernels = config['kernels']
     kernels['cat']['row_queue_capacity'] = 0
+    kernels['cat']['parallel'] = False
     kernels['hyper']['parallel'] = False
     kernels['kind']['row_queue_capacity'] = 0
-    kernels['kind']['parallel'] = False
+    kernels['kind']['row_parallel'] = False
 
 
 def protobuf_dump(config, message, warn='WARN ignoring config'):
@@ -27,6 +27,7 @@
 # USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 import uuid
+import socket
 from itertools import chain
 from collections import namedtuple
 import numpy
@@ -352,6 +353,50 @@ class ProtobufServer(object):
         self.close()
 
 
+class SocketServer(object):
+    '''
+    Client connection to a query server listening on unix:PATH or tcp:PORT,
+    as started by loom.runner.query(root, requests_in=address).
+    '''
+    def __init__(self, address, root=None):
+        self.root = root
+        kind, location = address.split(':', 1)
+        if kind == 'unix':
+            self.socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self.socket.connect(location)
+        elif kind == 'tcp':
+            self.socket = socket.create_connection(('localhost', location))
+        else:
+            raise ValueError('unsupported address: {}'.format(address))
+        self.file = self.socket.makefile('rwb')
+
+    def send(self, request):
+        assert isinstance(request, Query.Request), request
+        request_string = request.SerializeToString()
+        protobuf_stream_write(request_string, self.file)
+        self.file.flush()
+
+    def receive(self):
+        response_string = protobuf_stream_read(self.file)
+        response = Query.Response()
+        response.ParseFromString(response_string)
+        return response
+
+    def close(self):
+        self.file.close()
+        self.socket.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *unused):
+        self.close()
+
+
+def connect(address, root=None):
+    return QueryServer(SocketServer(address, root))
+
+
 def get_server(root, config=None, debug=False, profile=None):
     protobuf_server = ProtobufServer(root, config, debug, profile)
     return QueryServer(protobuf_server)
@@ -181,6 +181,7 @@ def shuffle(
         rows_out='-',
         seed=DEFAULTS['seed'],
         target_mem_bytes=DEFAULTS['target_mem_bytes'],
+        threads=0,
         debug=False,
         profile=None):
     '''
@@ -188,13 +189,54 @@ def shuffle(
     '''
     assert rows_in != rows_out, 'cannot shuffle rows in-place'
     check_call_files(
-        command=['shuffle', rows_in, rows_out, seed, target_mem_bytes],
+        command=[
+            'shuffle',
+            rows_in,
+            rows_out,
+            seed,
+            target_mem_bytes,
+            threads,
+        ],
         debug=debug,
         profile=profile,
         infiles=[rows_in],
         outfiles=[rows_out])
 
 
+@parsable.command
+def convert_rows(
+        schema_row_in,
+        rows_in,
+        rows_out,
+        rows_per_chunk=1024,
+        model_in=None,
+        debug=False,
+        profile=None):
+    '''
+    Convert a dataset between row-wise (.pbs) and columnar (.pbc) formats.
+    Columnar datasets can be read wherever row-wise datasets can.
+    If model_in is given, columns are grouped by the model's kinds.
+    '''
+    assert rows_in != rows_out, 'cannot convert rows in-place'
+    command = [
+        'convert_rows',
+        schema_row_in,
+        rows_in,
+        rows_out,
+        rows_per_chunk,
+    ]
+    infiles = [schema_row_in, rows_in]
+    if model_in is not None:
+        command.append(model_in)
+        infiles.append(model_in)
+    check_call_files(
+        command=command,
+        debug=debug,
+        profile=profile,
+        infiles=infiles,
+        outfiles=[rows_out])
+
+
 @parsable.command
 @loom.documented.transform(
     inputs=[
@@ -344,6 +386,28 @@ def posterior_enum(
         outfiles=[samples_out])
 
 
+@parsable.command
+def snapshot(
+        model_in,
+        groups_in,
+        snapshot_out,
+        debug=False,
+        profile=None):
+    '''
+    Pack a sample's model and groups into a single uncompressed file.
+    Loading it skips decompression and per-kind file opens, but still
+    parses and rebuilds every group.
+    The query server loads samples/sample.N/snapshot.bin when present
+    and its model and groups are unchanged since it was made.
+    '''
+    check_call_files(
+        command=['snapshot', model_in, groups_in, snapshot_out],
+        debug=debug,
+        profile=profile,
+        infiles=[model_in, groups_in],
+        outfiles=[snapshot_out])
+
+
 @parsable.command
 def query(
         root_in,
@@ -356,6 +420,8 @@ def query(
         block=True):
     '''
     Run query server from a trained model.
+    requests_in may be a socket address unix:PATH or tcp:PORT,
+    in which case the server listens until SIGINT or SIGTERM.
     '''
     log_out = optional_file(log_out)
     if config_in is None:
@@ -368,7 +434,8 @@ def query(
         config_in,
         responses_out,
         log_out]
-    infiles = [root_in, requests_in]
+    is_socket = requests_in.startswith(('unix:', 'tcp:'))
+    infiles = [root_in] if is_socket else [root_in, requests_in]
     if block:
         check_call_files(
             command=command,
@@ -377,7 +444,7 @@ def query(
             infiles=infiles,
             outfiles=[responses_out, log_out])
     else:
-        assert requests_in == '-', 'cannot pipe requests'
+        assert requests_in == '-' or is_socket, 'cannot pipe requests'
         assert responses_out == '-', 'cannot pipe responses'
         assert_found(infiles)
         return popen_piped(command, debug, profile)
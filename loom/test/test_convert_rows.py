@@ -0,0 +1,110 @@
+# Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+# Copyright (c) 2015, Google, Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# - Redistributions of source code must retain the above copyright
+#   notice, this list of conditions and the following disclaimer.
+# - Redistributions in binary form must reproduce the above copyright
+#   notice, this list of conditions and the following disclaimer in the
+#   documentation and/or other materials provided with the distribution.
+# - Neither the name of Salesforce.com nor the names of its contributors
+#   may be used to endorse or promote products derived from this
+#   software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+# COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+# OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+# USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+import os
+from nose.tools import assert_list_equal
+from distributions.io.stream import protobuf_stream_load
+from loom.test.util import (
+    for_each_dataset,
+    CLEANUP_ON_ERROR,
+    assert_found,
+    load_rows,
+)
+from distributions.fileutil import tempdir
+import loom.config
+import loom.runner
+
+
+@for_each_dataset
+def test_round_trip(schema_row, diffs, **unused):
+    rows_per_chunk_list = [1, 7, 1024]
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        expected = load_rows(diffs)
+        for rows_per_chunk in rows_per_chunk_list:
+            chunks = os.path.abspath('rows.{}.pbc.gz'.format(rows_per_chunk))
+            rows_out = os.path.abspath('rows.{}.pbs.gz'.format(rows_per_chunk))
+            loom.runner.convert_rows(
+                schema_row_in=schema_row,
+                rows_in=diffs,
+                rows_out=chunks,
+                rows_per_chunk=rows_per_chunk)
+            assert_found(chunks)
+            loom.runner.convert_rows(
+                schema_row_in=schema_row,
+                rows_in=chunks,
+                rows_out=rows_out)
+            assert_found(rows_out)
+            assert_list_equal(load_rows(rows_out), expected)
+
+
+@for_each_dataset
+def test_shuffle(schema_row, diffs, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        seed = 12345
+        chunks = os.path.abspath('rows.pbc.gz')
+        loom.runner.convert_rows(
+            schema_row_in=schema_row,
+            rows_in=diffs,
+            rows_out=chunks,
+            rows_per_chunk=7)
+
+        results = []
+        for i, rows_in in enumerate([diffs, chunks]):
+            rows_out = os.path.abspath('shuffled.{}.pbs.gz'.format(i))
+            loom.runner.shuffle(rows_in=rows_in, rows_out=rows_out, seed=seed)
+            results.append(load_rows(rows_out))
+        assert_list_equal(results[0], results[1])
+
+
+@for_each_dataset
+def test_infer(schema_row, tares, shuffled, init, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        chunks = os.path.abspath('shuffled.pbc.gz')
+        loom.runner.convert_rows(
+            schema_row_in=schema_row,
+            rows_in=shuffled,
+            rows_out=chunks,
+            rows_per_chunk=7,
+            model_in=init)
+
+        config_in = os.path.abspath('config.pb.gz')
+        config = {'schedule': {'extra_passes': 0.0}}
+        loom.config.config_dump(config, config_in)
+
+        results = []
+        for i, rows_in in enumerate([shuffled, chunks]):
+            assign_out = os.path.abspath('assign.{}.pbs.gz'.format(i))
+            loom.runner.infer(
+                config_in=config_in,
+                rows_in=rows_in,
+                tares_in=tares,
+                model_in=init,
+                assign_out=assign_out,
+                debug=True)
+            results.append(list(protobuf_stream_load(assign_out)))
+        assert_list_equal(results[0], results[1])
@@ -26,8 +26,13 @@
 # TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 # USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+import os
+import math
+import time
+import signal
 from itertools import izip
 from nose.tools import assert_equal
+from nose.tools import assert_false
 from nose.tools import assert_set_equal
 from nose.tools import assert_not_equal
 from nose.tools import assert_true
@@ -35,7 +40,7 @@ from distributions.dbg.random import sample_bernoulli
 from distributions.io.stream import json_load
 from distributions.io.stream import open_compressed
 from distributions.fileutil import tempdir
-from loom.schema_pb2 import ProductValue, CrossCat, Query
+from loom.schema_pb2 import ProductValue, CrossCat, Query, Config
 from loom.test.util import for_each_dataset
 import loom.query
 from loom.query import protobuf_to_data_row
@@ -182,6 +187,15 @@ def test_batch_score(root, model, rows, **unused):
         assert_equal(len(scores), len(rows))
 
 
+@for_each_dataset
+def test_score_loaded_rows(root, rows, **unused):
+    # scores read the groups loaded from the sample, not just empty groups
+    with loom.query.get_server(root, debug=True) as server:
+        for row in load_rows(rows)[:20]:
+            score = server.score(protobuf_to_data_row(row.diff))
+            assert_false(math.isnan(score) or math.isinf(score), score)
+
+
 @for_each_dataset
 def test_score_derivative_runs(root, rows, **unused):
     with loom.query.get_server(root, debug=True) as server:
@@ -230,6 +244,89 @@ def test_seed(root, model, rows, **unused):
     assert_not_equal(responses1, responses3)
 
 
+@for_each_dataset
+def test_concurrent(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'score')
+    expected_ids = [request.id for request in requests]
+    for ordered in [True, False]:
+        with tempdir():
+            config = {'query': {'threads': 4, 'ordered': ordered}}
+            loom.config.config_dump(config, 'config.pb.gz')
+            config_in = 'config.pb.gz'
+            with loom.query.ProtobufServer(root, config=config_in) as server:
+                for request in requests:
+                    server.send(request)
+                responses = [server.receive() for _ in requests]
+        for response in responses:
+            assert_equal(len(response.error), 0)
+        actual_ids = [response.id for response in responses]
+        if ordered:
+            assert_equal(actual_ids, expected_ids)
+        else:
+            assert_equal(sorted(actual_ids), sorted(expected_ids))
+
+
+@for_each_dataset
+def test_config_without_query_threads(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'score')
+    expected_ids = [request.id for request in requests]
+    with tempdir():
+        config = {}
+        loom.config.fill_in_defaults(config)
+        del config['query']['threads']
+        del config['query']['ordered']
+        message = Config()
+        loom.config.protobuf_dump(config, message)
+        assert_false(message.query.HasField('threads'))
+        with open_compressed('config.pb.gz', 'wb') as f:
+            f.write(message.SerializeToString())
+        with loom.query.ProtobufServer(root, config='config.pb.gz') as server:
+            for request in requests:
+                server.send(request)
+            responses = [server.receive() for _ in requests]
+    for response in responses:
+        assert_equal(len(response.error), 0)
+    actual_ids = [response.id for response in responses]
+    assert_equal(actual_ids, expected_ids)
+
+
+@for_each_dataset
+def test_socket(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'score')
+    with tempdir():
+        path = os.path.abspath('query.sock')
+        address = 'unix:{}'.format(path)
+        config = {'query': {'threads': 2}}
+        loom.config.config_dump(config, 'config.pb.gz')
+        proc = loom.runner.query(
+            root_in=root,
+            requests_in=address,
+            config_in='config.pb.gz',
+            debug=True,
+            block=False)
+        try:
+            while not os.path.exists(path):
+                assert_equal(proc.poll(), None)
+                time.sleep(0.1)
+            # more clients than threads, all held open at once
+            clients = [loom.query.SocketServer(address) for _ in xrange(5)]
+            for request in requests:
+                for client in clients:
+                    client.send(request)
+                for client in clients:
+                    check_response(request, client.receive())
+            clients[0].close()
+            proc.send_signal(signal.SIGTERM)
+            assert_equal(proc.wait(), 0)
+            assert_false(os.path.exists(path))
+            for client in clients[1:]:
+                client.close()
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+                proc.wait()
+
+
 @for_each_dataset
 def test_tiled_entropy(root, schema, **unused):
     feature_count = len(json_load(schema))
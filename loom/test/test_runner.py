@@ -139,6 +139,35 @@ CONFIGS = [
             },
         },
     },
+    {
+        'schedule': {'extra_passes': 1.5},
+        'kernels': {
+            'cat': {
+                'empty_group_count': 1,
+                'row_queue_capacity': 8,
+                'row_cache': True,
+            },
+            'kind': {'iterations': 0},
+        },
+        'rows': {'readahead_depth': 4},
+    },
+    {
+        'schedule': {'extra_passes': 1.5, 'max_reject_iters': 100},
+        'kernels': {
+            'cat': {
+                'empty_group_count': 1,
+                'row_queue_capacity': 8,
+                'row_batch_size': 4,
+            },
+            'kind': {
+                'iterations': 1,
+                'empty_kind_count': 1,
+                'row_queue_capacity': 8,
+                'row_batch_size': 4,
+                'score_parallel': True,
+            },
+        },
+    },
 ]
 
 
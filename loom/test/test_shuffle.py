@@ -81,3 +81,49 @@ def test_chunking(rows, **unused):
         for i, actual in enumerate(results):
             for expected in results[:i]:
                 assert_list_equal(actual, expected)
+
+
+@for_each_dataset
+def test_multilevel_scatter(rows, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        seed = 12345
+        in_memory = os.path.abspath('rows.in_memory.pbs.gz')
+        multilevel = os.path.abspath('rows.multilevel.pbs.gz')
+        loom.runner.shuffle(
+            rows_in=rows,
+            rows_out=in_memory,
+            seed=seed,
+            target_mem_bytes=1e12)
+        # buckets of more than one row are scattered again
+        loom.runner.shuffle(
+            rows_in=rows,
+            rows_out=multilevel,
+            seed=seed,
+            target_mem_bytes=1.0)
+        temps = [f for f in os.listdir('.') if f.startswith('loom_shuffle')]
+        assert_equal(temps, [])
+
+        expected = load_rows_raw(in_memory)
+        actual = load_rows_raw(multilevel)
+        assert_list_equal(actual, expected)
+
+
+@for_each_dataset
+def test_threading(rows, **unused):
+    thread_counts = [1, 2, 3, 8]
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        seed = 12345
+        rows_out = os.path.abspath('rows.out.{}.pbs.gz')
+
+        for threads in thread_counts:
+            loom.runner.shuffle(
+                rows_in=rows,
+                rows_out=rows_out.format(threads),
+                seed=seed,
+                target_mem_bytes=1000.0,
+                threads=threads)
+
+        expected = load_rows_raw(rows_out.format(thread_counts[0]))
+        for threads in thread_counts[1:]:
+            actual = load_rows_raw(rows_out.format(threads))
+            assert_list_equal(actual, expected)
@@ -0,0 +1,89 @@
+# Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+# Copyright (c) 2015, Google, Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# - Redistributions of source code must retain the above copyright
+#   notice, this list of conditions and the following disclaimer.
+# - Redistributions in binary form must reproduce the above copyright
+#   notice, this list of conditions and the following disclaimer in the
+#   documentation and/or other materials provided with the distribution.
+# - Neither the name of Salesforce.com nor the names of its contributors
+#   may be used to endorse or promote products derived from this
+#   software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+# COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+# OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+# USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+import os
+import shutil
+from nose.tools import assert_equal
+from loom.test.util import for_each_dataset, CLEANUP_ON_ERROR, assert_found
+from loom.test.test_query import get_example_requests, get_response
+from distributions.fileutil import tempdir
+import loom.config
+import loom.query
+import loom.runner
+import loom.store
+
+
+@for_each_dataset
+def test_snapshot(model, groups, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        snapshot_out = os.path.abspath('snapshot.bin')
+        loom.runner.snapshot(
+            model_in=model,
+            groups_in=groups,
+            snapshot_out=snapshot_out)
+        assert_found(snapshot_out)
+        with open(snapshot_out, 'rb') as f:
+            assert_equal(f.read(8), 'LOOMSNAP')
+
+
+def get_snapshot_path(root, seed):
+    # this must match loom::store::get_paths(-,-) in src/store.hpp
+    return os.path.join(loom.store.get_sample_path(root, seed), 'snapshot.bin')
+
+
+def get_responses(root, requests):
+    loom.config.config_dump({'seed': 0}, 'config.pb.gz')
+    with loom.query.ProtobufServer(root, config='config.pb.gz') as server:
+        return [get_response(server, request) for request in requests]
+
+
+@for_each_dataset
+def test_snapshot_query(root, model, rows, **unused):
+    requests = get_example_requests(model, rows, 'mixed')
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        root_copy = os.path.abspath('root')
+        shutil.copytree(root, root_copy)
+        samples = loom.store.get_paths(root_copy, sample_count=None)['samples']
+        assert len(samples) >= 2, 'too few samples to test staleness'
+        expected = get_responses(root_copy, requests)
+
+        # current snapshots are loaded in place of model and groups
+        for seed, sample in enumerate(samples):
+            loom.runner.snapshot(
+                model_in=sample['model'],
+                groups_in=sample['groups'],
+                snapshot_out=get_snapshot_path(root_copy, seed))
+        assert_equal(get_responses(root_copy, requests), expected)
+
+        # swapped snapshots are stale, so samples fall back to their sources
+        snapshot_0 = get_snapshot_path(root_copy, 0)
+        snapshot_1 = get_snapshot_path(root_copy, 1)
+        os.rename(snapshot_0, 'snapshot.bin')
+        os.rename(snapshot_1, snapshot_0)
+        os.rename('snapshot.bin', snapshot_1)
+        assert_equal(get_responses(root_copy, requests), expected)
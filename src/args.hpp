@@ -64,6 +64,16 @@ public:
         }
     }
 
+    const char * pop_default (const char * default_value)
+    {
+        if (argc_) {
+            --argc_;
+            return *argv_++;
+        } else {
+            return default_value;
+        }
+    }
+
     double pop_default (double default_value)
     {
         if (argc_) {
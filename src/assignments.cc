@@ -84,7 +84,7 @@ void Assignments::dump (
         }
     }
 
-    protobuf::OutFile file(filename);
+    protobuf::OutFile file(filename, protobuf::OutFile::BLOCK_GZIP);
     protobuf::Assignment assignment;
     for (size_t r = 0; r < row_count; ++r) {
         assignment.clear_groupids();
@@ -0,0 +1,503 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <zlib.h>
+#include <string.h>
+#include <vector>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <loom/common.hpp>
+
+// Block-gzip streams write and read a sequence of independently deflated
+// gzip members of at most 64KB each, marked by a 'BC' extra subfield in
+// the style of BGZF.  Ordinary gunzip reads these as concatenated gzip
+// members, while loom (de)compresses a batch of members in parallel and
+// can seek to any member boundary.
+
+namespace loom
+{
+namespace protobuf
+{
+
+namespace block_gzip
+{
+
+enum
+{
+    header_size = 18,
+    trailer_size = 8,
+    max_member_size = 0x10000,
+    max_data_size = 0xff00,     // leaves room for an uncompressible block
+    batch_size = 64             // members (de)compressed in parallel
+};
+
+inline uint32_t get_uint16 (const char * data)
+{
+    const auto * bytes = reinterpret_cast<const unsigned char *>(data);
+    return bytes[0] | (bytes[1] << 8);
+}
+
+inline uint32_t get_uint32 (const char * data)
+{
+    const auto * bytes = reinterpret_cast<const unsigned char *>(data);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+        (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+inline void put_uint16 (char * data, uint32_t value)
+{
+    data[0] = value & 0xff;
+    data[1] = (value >> 8) & 0xff;
+}
+
+inline void put_uint32 (char * data, uint32_t value)
+{
+    put_uint16(data, value);
+    put_uint16(data + 2, value >> 16);
+}
+
+inline bool is_header (const char * data, size_t size)
+{
+    return size >= header_size and
+        data[0] == '\x1f' and data[1] == '\x8b' and data[2] == 8 and
+        (data[3] & 4) and                   // FEXTRA
+        get_uint16(data + 10) == 6 and      // XLEN
+        data[12] == 'B' and data[13] == 'C' and get_uint16(data + 14) == 2;
+}
+
+// returns the total size of the member starting with this header
+inline size_t get_member_size (const char * header)
+{
+    return get_uint16(header + 16) + 1;
+}
+
+inline size_t compress (
+        const char * data,
+        size_t size,
+        char * member,
+        int level)
+{
+    LOOM_ASSERT_LE(size, max_data_size);
+    const size_t max_deflated_size =
+        max_member_size - header_size - trailer_size;
+
+    z_stream zstream;
+    size_t deflated_size = 0;
+    for (int attempt_level : {level, Z_NO_COMPRESSION}) {
+        memset(& zstream, 0, sizeof(zstream));
+        int status = deflateInit2(
+            & zstream,
+            attempt_level,
+            Z_DEFLATED,
+            -MAX_WBITS,     // raw deflate; we write our own header
+            8,
+            Z_DEFAULT_STRATEGY);
+        LOOM_ASSERT(status == Z_OK, "deflateInit2 failed");
+        zstream.next_in =
+            reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zstream.avail_in = size;
+        zstream.next_out = reinterpret_cast<Bytef *>(member + header_size);
+        zstream.avail_out = max_deflated_size;
+        status = deflate(& zstream, Z_FINISH);
+        deflated_size = zstream.total_out;
+        deflateEnd(& zstream);
+        if (status == Z_STREAM_END) {
+            break;
+        }
+        LOOM_ASSERT(
+            attempt_level != Z_NO_COMPRESSION,
+            "block does not fit in a gzip member");
+    }
+
+    const size_t member_size = header_size + deflated_size + trailer_size;
+    const char header[header_size] = {
+        '\x1f', '\x8b', 8, 4,   // magic, deflate, FEXTRA
+        0, 0, 0, 0,             // mtime
+        0, '\xff',              // xfl, unknown os
+        6, 0,                   // XLEN
+        'B', 'C', 2, 0,         // subfield id and length
+        0, 0                    // member size - 1
+    };
+    memcpy(member, header, header_size);
+    put_uint16(member + 16, member_size - 1);
+
+    char * trailer = member + header_size + deflated_size;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(data), size);
+    put_uint32(trailer, crc);
+    put_uint32(trailer + 4, size);
+
+    return member_size;
+}
+
+inline size_t decompress (
+        const char * member,
+        size_t member_size,
+        char * data)
+{
+    LOOM_ASSERT(
+        member_size >= header_size + trailer_size,
+        "truncated gzip member");
+    const char * trailer = member + member_size - trailer_size;
+    const size_t size = get_uint32(trailer + 4);
+    LOOM_ASSERT_LE(size, max_member_size);
+
+    z_stream zstream;
+    memset(& zstream, 0, sizeof(zstream));
+    int status = inflateInit2(& zstream, -MAX_WBITS);
+    LOOM_ASSERT(status == Z_OK, "inflateInit2 failed");
+    zstream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(member + header_size));
+    zstream.avail_in = member_size - header_size - trailer_size;
+    zstream.next_out = reinterpret_cast<Bytef *>(data);
+    zstream.avail_out = size;
+    status = inflate(& zstream, Z_FINISH);
+    const size_t inflated_size = zstream.total_out;
+    inflateEnd(& zstream);
+    LOOM_ASSERT(
+        status == Z_STREAM_END and inflated_size == size,
+        "corrupt gzip member");
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(data), size);
+    LOOM_ASSERT(crc == get_uint32(trailer), "gzip member crc mismatch");
+
+    return size;
+}
+
+struct Block
+{
+    std::vector<char> data;
+    std::vector<char> member;
+    size_t size;
+};
+
+} // namespace block_gzip
+
+//----------------------------------------------------------------------------
+// Block Gzip Output Stream
+
+class BlockGzipOutputStream :
+    public google::protobuf::io::ZeroCopyOutputStream,
+    noncopyable
+{
+public:
+
+    BlockGzipOutputStream (
+            google::protobuf::io::ZeroCopyOutputStream * output,
+            int level = Z_DEFAULT_COMPRESSION) :
+        output_(output),
+        level_(level),
+        blocks_(block_gzip::batch_size),
+        current_(0),
+        flushed_byte_count_(0),
+        compressed_byte_count_(0),
+        closed_(false)
+    {
+        for (auto & block : blocks_) {
+            block.data.resize(block_gzip::max_data_size);
+            block.member.resize(block_gzip::max_member_size);
+            block.size = 0;
+        }
+    }
+
+    ~BlockGzipOutputStream ()
+    {
+        Close();
+    }
+
+    bool Next (void ** data, int * size)
+    {
+        LOOM_ASSERT1(not closed_, "stream is closed");
+        if (blocks_[current_].size == block_gzip::max_data_size) {
+            if (++current_ == blocks_.size()) {
+                _write_batch();
+            }
+        }
+        auto & block = blocks_[current_];
+        * data = block.data.data() + block.size;
+        * size = block_gzip::max_data_size - block.size;
+        block.size = block_gzip::max_data_size;
+        return true;
+    }
+
+    void BackUp (int count)
+    {
+        LOOM_ASSERT_LE(count, blocks_[current_].size);
+        blocks_[current_].size -= count;
+    }
+
+    google::protobuf::int64 ByteCount () const
+    {
+        return flushed_byte_count_ +
+            current_ * block_gzip::max_data_size +
+            blocks_[current_].size;
+    }
+
+    // writes all buffered data as complete gzip members
+    bool Flush ()
+    {
+        if (not closed_) {
+            if (blocks_[current_].size) {
+                ++current_;
+            }
+            _write_batch();
+        }
+        return true;
+    }
+
+    // flushes and appends an empty end-of-file member
+    bool Close ()
+    {
+        if (not closed_) {
+            Flush();
+            auto & block = blocks_[0];
+            size_t member_size =
+                block_gzip::compress(nullptr, 0, block.member.data(), level_);
+            _write(block.member.data(), member_size);
+            closed_ = true;
+        }
+        return true;
+    }
+
+    // parallel lists of (compressed, uncompressed) start of each member
+    const std::vector<uint64_t> & member_offsets () const
+    {
+        return member_offsets_;
+    }
+    const std::vector<uint64_t> & member_starts () const
+    {
+        return member_starts_;
+    }
+
+private:
+
+    void _write_batch ()
+    {
+        const size_t block_count = current_;
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = 0; i < block_count; ++i) {
+            auto & block = blocks_[i];
+            size_t member_size = block_gzip::compress(
+                block.data.data(),
+                block.size,
+                block.member.data(),
+                level_);
+            block.member.resize(member_size);
+        }
+
+        for (size_t i = 0; i < block_count; ++i) {
+            auto & block = blocks_[i];
+            member_offsets_.push_back(compressed_byte_count_);
+            member_starts_.push_back(flushed_byte_count_);
+            _write(block.member.data(), block.member.size());
+            flushed_byte_count_ += block.size;
+            block.member.resize(block_gzip::max_member_size);
+            block.size = 0;
+        }
+        current_ = 0;
+    }
+
+    void _write (const char * data, size_t size)
+    {
+        compressed_byte_count_ += size;
+        while (size) {
+            void * buffer;
+            int buffer_size;
+            bool success = output_->Next(& buffer, & buffer_size);
+            LOOM_ASSERT(success, "failed to write block gzip stream");
+            size_t count = std::min(size, static_cast<size_t>(buffer_size));
+            memcpy(buffer, data, count);
+            data += count;
+            size -= count;
+            if (count < static_cast<size_t>(buffer_size)) {
+                output_->BackUp(buffer_size - count);
+            }
+        }
+    }
+
+    google::protobuf::io::ZeroCopyOutputStream * const output_;
+    const int level_;
+    std::vector<block_gzip::Block> blocks_;
+    size_t current_;
+    uint64_t flushed_byte_count_;
+    uint64_t compressed_byte_count_;
+    std::vector<uint64_t> member_offsets_;
+    std::vector<uint64_t> member_starts_;
+    bool closed_;
+};
+
+//----------------------------------------------------------------------------
+// Block Gzip Input Stream
+
+class BlockGzipInputStream :
+    public google::protobuf::io::ZeroCopyInputStream,
+    noncopyable
+{
+public:
+
+    BlockGzipInputStream (google::protobuf::io::ZeroCopyInputStream * input) :
+        input_(input),
+        blocks_(block_gzip::batch_size),
+        block_count_(0),
+        current_(0),
+        pos_(0),
+        byte_count_(0)
+    {
+        for (auto & block : blocks_) {
+            block.data.resize(block_gzip::max_member_size);
+            block.member.resize(block_gzip::max_member_size);
+            block.size = 0;
+        }
+    }
+
+    // peeks at the first member header without consuming input
+    static bool sniff (google::protobuf::io::ZeroCopyInputStream * input)
+    {
+        const void * data;
+        int size;
+        if (input->Next(& data, & size)) {
+            input->BackUp(size);
+            return block_gzip::is_header(static_cast<const char *>(data), size);
+        } else {
+            return false;
+        }
+    }
+
+    bool Next (const void ** data, int * size)
+    {
+        while (current_ == block_count_ or pos_ == blocks_[current_].size) {
+            if (current_ + 1 < block_count_) {
+                ++current_;
+                pos_ = 0;
+            } else if (not _read_batch()) {
+                return false;
+            }
+        }
+        const auto & block = blocks_[current_];
+        * data = block.data.data() + pos_;
+        * size = block.size - pos_;
+        byte_count_ += block.size - pos_;
+        pos_ = block.size;
+        return true;
+    }
+
+    void BackUp (int count)
+    {
+        LOOM_ASSERT_LE(count, pos_);
+        pos_ -= count;
+        byte_count_ -= count;
+    }
+
+    bool Skip (int count)
+    {
+        const void * data;
+        int size;
+        while (count > 0) {
+            if (not Next(& data, & size)) {
+                return false;
+            }
+            if (size > count) {
+                BackUp(size - count);
+                return true;
+            }
+            count -= size;
+        }
+        return true;
+    }
+
+    google::protobuf::int64 ByteCount () const { return byte_count_; }
+
+private:
+
+    bool _read_batch ()
+    {
+        block_count_ = 0;
+        current_ = 0;
+        pos_ = 0;
+        for (; block_count_ < blocks_.size(); ++block_count_) {
+            auto & block = blocks_[block_count_];
+            char * header = block.member.data();
+            size_t size = _read(header, block_gzip::header_size);
+            if (size == 0) {
+                break;
+            }
+            LOOM_ASSERT(
+                block_gzip::is_header(header, size),
+                "expected a block gzip member header");
+            size_t member_size = block_gzip::get_member_size(header);
+            size_t rest = member_size - block_gzip::header_size;
+            LOOM_ASSERT_EQ(_read(header + block_gzip::header_size, rest), rest);
+            block.size = member_size;
+        }
+
+        const size_t block_count = block_count_;
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = 0; i < block_count; ++i) {
+            auto & block = blocks_[i];
+            block.size = block_gzip::decompress(
+                block.member.data(),
+                block.size,
+                block.data.data());
+        }
+
+        return block_count_ > 0;
+    }
+
+    size_t _read (char * data, size_t size)
+    {
+        size_t total = 0;
+        while (total < size) {
+            const void * buffer;
+            int buffer_size;
+            if (not input_->Next(& buffer, & buffer_size)) {
+                break;
+            }
+            size_t count =
+                std::min(size - total, static_cast<size_t>(buffer_size));
+            memcpy(data + total, buffer, count);
+            total += count;
+            if (count < static_cast<size_t>(buffer_size)) {
+                input_->BackUp(buffer_size - count);
+            }
+        }
+        return total;
+    }
+
+    google::protobuf::io::ZeroCopyInputStream * const input_;
+    std::vector<block_gzip::Block> blocks_;
+    size_t block_count_;
+    size_t current_;
+    size_t pos_;
+    uint64_t byte_count_;
+};
+
+} // namespace protobuf
+} // namespace loom
@@ -39,6 +39,9 @@ namespace loom
 
 using ::distributions::sample_from_scores_overwrite;
 
+// When parallel, each row's independent per-kind tasks run across an
+// OpenMP team, each kind with its own scores buffer and an rng seeded
+// from the caller's rng.
 class CatKernel : noncopyable
 {
 public:
@@ -48,9 +51,12 @@ public:
     CatKernel (
             const protobuf::Config::Kernels::Cat & config,
             CrossCat & cross_cat) :
+        parallel_(config.parallel()),
         cross_cat_(cross_cat),
         partial_diffs_(),
+        groupids_(),
         scores_(),
+        kind_scores_(),
         timer_()
     {
         LOOM_ASSERT_LT(0, config.empty_group_count());
@@ -97,9 +103,27 @@ public:
 
 private:
 
+    template<class Fun>
+    void for_each_kind (rng_t & rng, const Fun & fun);
+
+    size_t add_to_kind (
+            CrossCat::Kind & kind,
+            const ProductValue::Diff & partial_diff,
+            VectorFloat & scores,
+            rng_t & rng);
+
+    void remove_from_kind (
+            CrossCat::Kind & kind,
+            const ProductValue::Diff & partial_diff,
+            size_t groupid,
+            rng_t & rng);
+
+    const bool parallel_;
     CrossCat & cross_cat_;
     std::vector<ProductValue::Diff> partial_diffs_;
+    std::vector<size_t> groupids_;
     VectorFloat scores_;
+    std::vector<VectorFloat> kind_scores_;
     Timer timer_;
 };
 
@@ -110,6 +134,78 @@ inline void CatKernel::log_metrics (Logger::Message & message)
     timer_.clear();
 }
 
+template<class Fun>
+inline void CatKernel::for_each_kind (rng_t & rng, const Fun & fun)
+{
+    const size_t kind_count = cross_cat_.kinds.size();
+    if (parallel_ and kind_count > 1) {
+        kind_scores_.resize(kind_count);
+        const auto seed = rng();
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+            rng_t rng(seed + kindid);
+            fun(kindid, kind_scores_[kindid], rng);
+        }
+
+    } else {
+
+        for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+            fun(kindid, scores_, rng);
+        }
+    }
+}
+
+inline size_t CatKernel::add_to_kind (
+        CrossCat::Kind & kind,
+        const ProductValue::Diff & partial_diff,
+        VectorFloat & scores,
+        rng_t & rng)
+{
+    ProductModel & model = kind.model;
+    auto & mixture = kind.mixture;
+
+    size_t groupid;
+    if (cross_cat_.tares.empty()) {
+        FlatValue & value = thread_local_flat_value(
+            model.schema,
+            model.features,
+            partial_diff.pos());
+        model.add_value(value, rng);
+        mixture.score_value(model, value, scores, rng);
+        groupid = sample_from_scores_overwrite(rng, scores);
+        mixture.add_value(model, groupid, value, rng);
+    } else {
+        model.add_diff(partial_diff, rng);
+        mixture.score_diff(model, partial_diff, scores, rng);
+        groupid = sample_from_scores_overwrite(rng, scores);
+        mixture.add_diff(model, groupid, partial_diff, rng);
+    }
+    return groupid;
+}
+
+inline void CatKernel::remove_from_kind (
+        CrossCat::Kind & kind,
+        const ProductValue::Diff & partial_diff,
+        size_t groupid,
+        rng_t & rng)
+{
+    ProductModel & model = kind.model;
+    auto & mixture = kind.mixture;
+
+    if (cross_cat_.tares.empty()) {
+        FlatValue & value = thread_local_flat_value(
+            model.schema,
+            model.features,
+            partial_diff.pos());
+        mixture.remove_value(model, groupid, value, rng);
+        model.remove_value(value, rng);
+    } else {
+        mixture.remove_diff(model, groupid, partial_diff, rng);
+        model.remove_diff(partial_diff, rng);
+    }
+}
+
 inline void CatKernel::add_row_noassign (
         rng_t & rng,
         const protobuf::Row & row)
@@ -118,26 +214,9 @@ inline void CatKernel::add_row_noassign (
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
 
-    const size_t kind_count = cross_cat_.kinds.size();
-    for (size_t i = 0; i < kind_count; ++i) {
-        const auto & partial_diff = partial_diffs_[i];
-        auto & kind = cross_cat_.kinds[i];
-        ProductModel & model = kind.model;
-        auto & mixture = kind.mixture;
-
-        if (cross_cat_.tares.empty()) {
-            auto & value = partial_diff.pos();
-            model.add_value(value, rng);
-            mixture.score_value(model, value, scores_, rng);
-            size_t groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_value(model, groupid, value, rng);
-        } else {
-            model.add_diff(partial_diff, rng);
-            mixture.score_diff(model, partial_diff, scores_, rng);
-            size_t groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_diff(model, groupid, partial_diff, rng);
-        }
-    }
+    for_each_kind(rng, [&](size_t i, VectorFloat & scores, rng_t & rng){
+        add_to_kind(cross_cat_.kinds[i], partial_diffs_[i], scores, rng);
+    });
 }
 
 inline void CatKernel::add_row (
@@ -151,26 +230,15 @@ inline void CatKernel::add_row (
     packed_assignment_out.set_rowid(row.id());
     packed_assignment_out.clear_groupids();
 
-    const size_t kind_count = cross_cat_.kinds.size();
-    for (size_t i = 0; i < kind_count; ++i) {
-        const auto & partial_diff = partial_diffs_[i];
-        auto & kind = cross_cat_.kinds[i];
-        ProductModel & model = kind.model;
-        auto & mixture = kind.mixture;
-
-        size_t groupid;
-        if (cross_cat_.tares.empty()) {
-            auto & value = partial_diff.pos();
-            model.add_value(value, rng);
-            mixture.score_value(model, value, scores_, rng);
-            groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_value(model, groupid, value, rng);
-        } else {
-            model.add_diff(partial_diff, rng);
-            mixture.score_diff(model, partial_diff, scores_, rng);
-            groupid = sample_from_scores_overwrite(rng, scores_);
-            mixture.add_diff(model, groupid, partial_diff, rng);
-        }
+    groupids_.resize(cross_cat_.kinds.size());
+    for_each_kind(rng, [&](size_t i, VectorFloat & scores, rng_t & rng){
+        groupids_[i] = add_to_kind(
+            cross_cat_.kinds[i],
+            partial_diffs_[i],
+            scores,
+            rng);
+    });
+    for (auto groupid : groupids_) {
         packed_assignment_out.add_groupids(groupid);
     }
 }
@@ -186,15 +254,14 @@ inline void CatKernel::add_row (
 
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
-    const size_t kind_count = cross_cat_.kinds.size();
-    for (size_t i = 0; i < kind_count; ++i) {
+    for_each_kind(rng, [&](size_t i, VectorFloat & scores, rng_t & rng){
         process_add_task(
             cross_cat_.kinds[i],
             partial_diffs_[i],
-            scores_,
+            scores,
             assignments.groupids(i),
             rng);
-    }
+    });
 }
 
 inline void CatKernel::process_add_task (
@@ -204,23 +271,8 @@ inline void CatKernel::process_add_task (
         Groupids & groupids,
         rng_t & rng)
 {
-    ProductModel & model = kind.model;
-    auto & mixture = kind.mixture;
-
-    size_t groupid;
-    if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
-        model.add_value(value, rng);
-        mixture.score_value(model, value, scores, rng);
-        groupid = sample_from_scores_overwrite(rng, scores);
-        mixture.add_value(model, groupid, value, rng);
-    } else {
-        model.add_diff(partial_diff, rng);
-        mixture.score_diff(model, partial_diff, scores, rng);
-        groupid = sample_from_scores_overwrite(rng, scores);
-        mixture.add_diff(model, groupid, partial_diff, rng);
-    }
-    size_t global_groupid = mixture.id_tracker.packed_to_global(groupid);
+    size_t groupid = add_to_kind(kind, partial_diff, scores, rng);
+    size_t global_groupid = kind.mixture.id_tracker.packed_to_global(groupid);
     groupids.push(global_groupid);
 }
 
@@ -236,23 +288,13 @@ inline void CatKernel::remove_row (
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
 
-    const size_t kind_count = cross_cat_.kinds.size();
-    for (size_t i = 0; i < kind_count; ++i) {
-        const auto & partial_diff = partial_diffs_[i];
-        auto & kind = cross_cat_.kinds[i];
-        ProductModel & model = kind.model;
-        auto & mixture = kind.mixture;
-
-        auto groupid = packed_assignment.groupids(i);
-        if (cross_cat_.tares.empty()) {
-            auto & value = partial_diff.pos();
-            mixture.remove_value(model, groupid, value, rng);
-            model.remove_value(value, rng);
-        } else {
-            mixture.remove_diff(model, groupid, partial_diff, rng);
-            model.remove_diff(partial_diff, rng);
-        }
-    }
+    for_each_kind(rng, [&](size_t i, VectorFloat &, rng_t & rng){
+        remove_from_kind(
+            cross_cat_.kinds[i],
+            partial_diffs_[i],
+            packed_assignment.groupids(i),
+            rng);
+    });
 }
 
 inline void CatKernel::remove_row (
@@ -268,14 +310,13 @@ inline void CatKernel::remove_row (
 
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
-    const size_t kind_count = cross_cat_.kinds.size();
-    for (size_t i = 0; i < kind_count; ++i) {
+    for_each_kind(rng, [&](size_t i, VectorFloat &, rng_t & rng){
         process_remove_task(
             cross_cat_.kinds[i],
             partial_diffs_[i],
             assignments.groupids(i),
             rng);
-    }
+    });
 }
 
 inline void CatKernel::process_remove_task (
@@ -284,19 +325,9 @@ inline void CatKernel::process_remove_task (
         Groupids & groupids,
         rng_t & rng)
 {
-    ProductModel & model = kind.model;
-    auto & mixture = kind.mixture;
-
     auto global_groupid = groupids.pop();
-    auto groupid = mixture.id_tracker.global_to_packed(global_groupid);
-    if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
-        mixture.remove_value(model, groupid, value, rng);
-        model.remove_value(value, rng);
-    } else {
-        mixture.remove_diff(model, groupid, partial_diff, rng);
-        model.remove_diff(partial_diff, rng);
-    }
+    auto groupid = kind.mixture.id_tracker.global_to_packed(global_groupid);
+    remove_from_kind(kind, partial_diff, groupid, rng);
 }
 
 } // namespace loom
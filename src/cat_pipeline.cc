@@ -37,13 +37,20 @@ CatPipeline::CatPipeline (
         StreamInterval & rows,
         Assignments & assignments,
         CatKernel & cat_kernel,
-        rng_t & rng) :
-    pipeline_(config.row_queue_capacity(), stage_count),
+        rng_t & rng,
+        uint64_t stream_row_count,
+        size_t cache_capacity_bytes) :
+    pipeline_(
+        config.row_queue_capacity(),
+        stage_count,
+        config.spin_count(),
+        config.row_batch_size()),
     cross_cat_(cross_cat),
     rows_(rows),
     assignments_(assignments),
     cat_kernel_(cat_kernel),
-    rng_(rng)
+    rng_(rng),
+    cache_(stream_row_count, stream_row_count ? cache_capacity_bytes : 0)
 {
     start_threads(config.parser_threads());
 }
@@ -65,10 +72,22 @@ void CatPipeline::start_threads (size_t parser_threads)
         if (task.add) {
             task.parsed.clear();
             rows_.read_unassigned(task.raw);
+            task.position = rows_.unassigned_position();
         }
     });
     add_thread(0, [this](Task & task, const ThreadState &){
         if (not task.add) {
+            if (cache_.enabled()) {
+                const uint64_t position =
+                    cache_.next_position(rows_.assigned_position());
+                uint64_t rowid;
+                if (cache_.try_pop(position, rowid, task.partial_diffs)) {
+                    task.parsed.test_and_set();
+                    task.row.set_id(rowid);
+                    rows_.skip_assigned(position);
+                    return;
+                }
+            }
             task.parsed.clear();
             rows_.read_assigned(task.raw);
         }
@@ -83,6 +102,12 @@ void CatPipeline::start_threads (size_t parser_threads)
                 task.row.ParseFromArray(task.raw.data(), task.raw.size());
                 cross_cat_.splitter.split(task.row.diff(), task.partial_diffs);
                 cross_cat_.simplify(task.partial_diffs);
+                if (task.add and cache_.enabled()) {
+                    cache_.try_insert(
+                        task.position,
+                        task.row.id(),
+                        task.partial_diffs);
+                }
             }
         });
     }
@@ -34,6 +34,7 @@
 #include <loom/assignments.hpp>
 #include <loom/stream_interval.hpp>
 #include <loom/cat_kernel.hpp>
+#include <loom/diff_cache.hpp>
 #include <loom/pipeline.hpp>
 
 namespace loom
@@ -51,7 +52,9 @@ public:
             StreamInterval & rows,
             Assignments & assignments,
             CatKernel & cat_kernel,
-            rng_t & rng);
+            rng_t & rng,
+            uint64_t stream_row_count = 0,
+            size_t cache_capacity_bytes = 0);
 
     void add_row ()
     {
@@ -71,7 +74,8 @@ private:
     {
         std::atomic_flag parsed;
         bool add;
-        std::vector<char> raw;
+        uint64_t position;
+        protobuf::RawMessage raw;
         protobuf::Row row;
         std::vector<ProductValue::Diff> partial_diffs;
 
@@ -95,6 +99,7 @@ private:
     Assignments & assignments_;
     CatKernel & cat_kernel_;
     rng_t & rng_;
+    DiffCache cache_;
 };
 
 } // namespace loom
@@ -0,0 +1,552 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <string.h>
+#include <vector>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <loom/common.hpp>
+
+#ifdef LOOM_USE_ZSTD
+#include <zstd.h>
+#endif // LOOM_USE_ZSTD
+
+#ifdef LOOM_USE_LZ4
+#include <lz4frame.h>
+#endif // LOOM_USE_LZ4
+
+// Streaming codecs selected by file suffix, as with .gz:
+// .zst files are zstd frames and .lz4 files are lz4 frames.
+// Each codec is compiled in only if cmake finds its library.
+
+namespace loom
+{
+namespace protobuf
+{
+
+inline bool endswith (const char * filename, const char * suffix)
+{
+    return strlen(filename) >= strlen(suffix) and
+        strcmp(filename + strlen(filename) - strlen(suffix), suffix) == 0;
+}
+
+//----------------------------------------------------------------------------
+// Decoding Input Stream
+
+class DecodingInputStream :
+    public google::protobuf::io::ZeroCopyInputStream,
+    noncopyable
+{
+public:
+
+    enum { buffer_size = 1 << 17 };
+
+    DecodingInputStream (google::protobuf::io::ZeroCopyInputStream * input) :
+        input_(input),
+        buffer_(buffer_size),
+        begin_(0),
+        end_(0),
+        pending_(false),
+        in_data_(nullptr),
+        in_size_(0),
+        byte_count_(0)
+    {
+    }
+
+    bool Next (const void ** data, int * size)
+    {
+        if (begin_ == end_ and not _fill()) {
+            return false;
+        }
+        * data = buffer_.data() + begin_;
+        * size = end_ - begin_;
+        byte_count_ += end_ - begin_;
+        begin_ = end_;
+        return true;
+    }
+
+    void BackUp (int count)
+    {
+        LOOM_ASSERT_LE(count, begin_);
+        begin_ -= count;
+        byte_count_ -= count;
+    }
+
+    bool Skip (int count)
+    {
+        const void * data;
+        int size;
+        while (count > 0) {
+            if (not Next(& data, & size)) {
+                return false;
+            }
+            if (size > count) {
+                BackUp(size - count);
+                return true;
+            }
+            count -= size;
+        }
+        return true;
+    }
+
+    google::protobuf::int64 ByteCount () const { return byte_count_; }
+
+protected:
+
+    // Decodes some of [in, in + in_size) into [out, out + out_size),
+    // updating in_size and out_size to the counts consumed and produced.
+    virtual void _decode (
+            const char * in,
+            size_t & in_size,
+            char * out,
+            size_t & out_size) = 0;
+
+    // Whether the input so far ends on a frame boundary.
+    virtual bool _finished () const = 0;
+
+private:
+
+    bool _fill ()
+    {
+        begin_ = 0;
+        end_ = 0;
+        while (end_ == 0) {
+            if (in_size_ == 0 and not pending_) {
+                const void * data;
+                int size;
+                if (not input_->Next(& data, & size)) {
+                    LOOM_ASSERT(_finished(), "truncated compressed stream");
+                    return false;
+                }
+                in_data_ = static_cast<const char *>(data);
+                in_size_ = size;
+            }
+            size_t consumed = in_size_;
+            size_t produced = buffer_.size();
+            _decode(in_data_, consumed, buffer_.data(), produced);
+            in_data_ += consumed;
+            in_size_ -= consumed;
+            end_ = produced;
+            pending_ = (produced == buffer_.size());
+        }
+        return true;
+    }
+
+    google::protobuf::io::ZeroCopyInputStream * const input_;
+    std::vector<char> buffer_;
+    size_t begin_;
+    size_t end_;
+    bool pending_;
+    const char * in_data_;
+    size_t in_size_;
+    uint64_t byte_count_;
+};
+
+//----------------------------------------------------------------------------
+// Encoding Output Stream
+
+class EncodingOutputStream :
+    public google::protobuf::io::ZeroCopyOutputStream,
+    noncopyable
+{
+public:
+
+    enum { buffer_size = 1 << 17 };
+
+    EncodingOutputStream (google::protobuf::io::ZeroCopyOutputStream * output) :
+        output_(output),
+        buffer_(buffer_size),
+        size_(0),
+        byte_count_(0),
+        closed_(false)
+    {
+    }
+
+    bool Next (void ** data, int * size)
+    {
+        LOOM_ASSERT1(not closed_, "stream is closed");
+        if (size_ == buffer_.size()) {
+            _encode(buffer_.data(), size_, CONTINUE);
+            size_ = 0;
+        }
+        * data = buffer_.data() + size_;
+        * size = buffer_.size() - size_;
+        byte_count_ += buffer_.size() - size_;
+        size_ = buffer_.size();
+        return true;
+    }
+
+    void BackUp (int count)
+    {
+        LOOM_ASSERT_LE(count, size_);
+        size_ -= count;
+        byte_count_ -= count;
+    }
+
+    google::protobuf::int64 ByteCount () const { return byte_count_; }
+
+    bool Flush ()
+    {
+        if (not closed_) {
+            _encode(buffer_.data(), size_, FLUSH);
+            size_ = 0;
+        }
+        return true;
+    }
+
+    // Subclasses must Close() in their destructors.
+    bool Close ()
+    {
+        if (not closed_) {
+            _encode(buffer_.data(), size_, END);
+            size_ = 0;
+            closed_ = true;
+        }
+        return true;
+    }
+
+protected:
+
+    enum Mode { CONTINUE, FLUSH, END };
+
+    virtual void _encode (const char * data, size_t size, Mode mode) = 0;
+
+    void _write (const char * data, size_t size)
+    {
+        while (size) {
+            void * buffer;
+            int buffer_size;
+            bool success = output_->Next(& buffer, & buffer_size);
+            LOOM_ASSERT(success, "failed to write compressed stream");
+            size_t count = std::min(size, static_cast<size_t>(buffer_size));
+            memcpy(buffer, data, count);
+            data += count;
+            size -= count;
+            if (count < static_cast<size_t>(buffer_size)) {
+                output_->BackUp(buffer_size - count);
+            }
+        }
+    }
+
+private:
+
+    google::protobuf::io::ZeroCopyOutputStream * const output_;
+    std::vector<char> buffer_;
+    size_t size_;
+    uint64_t byte_count_;
+    bool closed_;
+};
+
+#ifdef LOOM_USE_ZSTD
+
+//----------------------------------------------------------------------------
+// Zstd
+
+class ZstdInputStream : public DecodingInputStream
+{
+public:
+
+    ZstdInputStream (google::protobuf::io::ZeroCopyInputStream * input) :
+        DecodingInputStream(input),
+        context_(ZSTD_createDCtx()),
+        hint_(0)
+    {
+        LOOM_ASSERT(context_, "failed to create zstd context");
+    }
+
+    ~ZstdInputStream ()
+    {
+        ZSTD_freeDCtx(context_);
+    }
+
+protected:
+
+    void _decode (
+            const char * in,
+            size_t & in_size,
+            char * out,
+            size_t & out_size)
+    {
+        ZSTD_inBuffer input = {in, in_size, 0};
+        ZSTD_outBuffer output = {out, out_size, 0};
+        hint_ = ZSTD_decompressStream(context_, & output, & input);
+        LOOM_ASSERT(
+            not ZSTD_isError(hint_),
+            "zstd error: " << ZSTD_getErrorName(hint_));
+        in_size = input.pos;
+        out_size = output.pos;
+    }
+
+    bool _finished () const { return hint_ == 0; }
+
+private:
+
+    ZSTD_DCtx * const context_;
+    size_t hint_;
+};
+
+class ZstdOutputStream : public EncodingOutputStream
+{
+public:
+
+    ZstdOutputStream (
+            google::protobuf::io::ZeroCopyOutputStream * output,
+            int level = 3) :
+        EncodingOutputStream(output),
+        context_(ZSTD_createCCtx()),
+        buffer_(ZSTD_CStreamOutSize())
+    {
+        LOOM_ASSERT(context_, "failed to create zstd context");
+        ZSTD_CCtx_setParameter(context_, ZSTD_c_compressionLevel, level);
+    }
+
+    ~ZstdOutputStream ()
+    {
+        Close();
+        ZSTD_freeCCtx(context_);
+    }
+
+protected:
+
+    void _encode (const char * data, size_t size, Mode mode)
+    {
+        static const ZSTD_EndDirective directives[] = {
+            ZSTD_e_continue,
+            ZSTD_e_flush,
+            ZSTD_e_end
+        };
+        const ZSTD_EndDirective directive = directives[mode];
+        ZSTD_inBuffer input = {data, size, 0};
+        while (true) {
+            ZSTD_outBuffer output = {buffer_.data(), buffer_.size(), 0};
+            size_t remaining =
+                ZSTD_compressStream2(context_, & output, & input, directive);
+            LOOM_ASSERT(
+                not ZSTD_isError(remaining),
+                "zstd error: " << ZSTD_getErrorName(remaining));
+            _write(buffer_.data(), output.pos);
+            if (directive == ZSTD_e_continue
+                    ? input.pos == input.size
+                    : remaining == 0)
+            {
+                break;
+            }
+        }
+    }
+
+private:
+
+    ZSTD_CCtx * const context_;
+    std::vector<char> buffer_;
+};
+
+#endif // LOOM_USE_ZSTD
+
+#ifdef LOOM_USE_LZ4
+
+//----------------------------------------------------------------------------
+// Lz4
+
+class Lz4InputStream : public DecodingInputStream
+{
+public:
+
+    Lz4InputStream (google::protobuf::io::ZeroCopyInputStream * input) :
+        DecodingInputStream(input),
+        hint_(0)
+    {
+        LZ4F_errorCode_t error =
+            LZ4F_createDecompressionContext(& context_, LZ4F_VERSION);
+        LOOM_ASSERT(
+            not LZ4F_isError(error),
+            "lz4 error: " << LZ4F_getErrorName(error));
+    }
+
+    ~Lz4InputStream ()
+    {
+        LZ4F_freeDecompressionContext(context_);
+    }
+
+protected:
+
+    void _decode (
+            const char * in,
+            size_t & in_size,
+            char * out,
+            size_t & out_size)
+    {
+        hint_ = LZ4F_decompress(
+            context_,
+            out,
+            & out_size,
+            in,
+            & in_size,
+            nullptr);
+        LOOM_ASSERT(
+            not LZ4F_isError(hint_),
+            "lz4 error: " << LZ4F_getErrorName(hint_));
+    }
+
+    bool _finished () const { return hint_ == 0; }
+
+private:
+
+    LZ4F_dctx * context_;
+    size_t hint_;
+};
+
+class Lz4OutputStream : public EncodingOutputStream
+{
+public:
+
+    Lz4OutputStream (google::protobuf::io::ZeroCopyOutputStream * output) :
+        EncodingOutputStream(output),
+        started_(false)
+    {
+        memset(& preferences_, 0, sizeof(preferences_));
+        LZ4F_errorCode_t error =
+            LZ4F_createCompressionContext(& context_, LZ4F_VERSION);
+        LOOM_ASSERT(
+            not LZ4F_isError(error),
+            "lz4 error: " << LZ4F_getErrorName(error));
+        buffer_.resize(
+            LZ4F_HEADER_SIZE_MAX +
+            LZ4F_compressBound(buffer_size, & preferences_));
+    }
+
+    ~Lz4OutputStream ()
+    {
+        Close();
+        LZ4F_freeCompressionContext(context_);
+    }
+
+protected:
+
+    void _encode (const char * data, size_t size, Mode mode)
+    {
+        if (not started_) {
+            _check(LZ4F_compressBegin(
+                context_,
+                buffer_.data(),
+                buffer_.size(),
+                & preferences_));
+            started_ = true;
+        }
+        if (size) {
+            _check(LZ4F_compressUpdate(
+                context_,
+                buffer_.data(),
+                buffer_.size(),
+                data,
+                size,
+                nullptr));
+        }
+        if (mode == FLUSH) {
+            _check(LZ4F_flush(
+                context_,
+                buffer_.data(),
+                buffer_.size(),
+                nullptr));
+        } else if (mode == END) {
+            _check(LZ4F_compressEnd(
+                context_,
+                buffer_.data(),
+                buffer_.size(),
+                nullptr));
+        }
+    }
+
+private:
+
+    void _check (size_t size)
+    {
+        LOOM_ASSERT(
+            not LZ4F_isError(size),
+            "lz4 error: " << LZ4F_getErrorName(size));
+        _write(buffer_.data(), size);
+    }
+
+    LZ4F_cctx * context_;
+    LZ4F_preferences_t preferences_;
+    std::vector<char> buffer_;
+    bool started_;
+};
+
+#endif // LOOM_USE_LZ4
+
+//----------------------------------------------------------------------------
+// Selection by suffix
+
+inline bool has_codec_suffix (const char * filename)
+{
+    return endswith(filename, ".zst") or endswith(filename, ".lz4");
+}
+
+// returns nullptr if filename has no codec suffix
+inline DecodingInputStream * new_decoding_stream (
+        const char * filename,
+        google::protobuf::io::ZeroCopyInputStream * input)
+{
+    static_cast<void>(input);  // unused if built without codecs
+    if (endswith(filename, ".zst")) {
+#ifdef LOOM_USE_ZSTD
+        return new ZstdInputStream(input);
+#endif // LOOM_USE_ZSTD
+        LOOM_ERROR("loom was built without zstd support: " << filename);
+    } else if (endswith(filename, ".lz4")) {
+#ifdef LOOM_USE_LZ4
+        return new Lz4InputStream(input);
+#endif // LOOM_USE_LZ4
+        LOOM_ERROR("loom was built without lz4 support: " << filename);
+    }
+    return nullptr;
+}
+
+// returns nullptr if filename has no codec suffix
+inline EncodingOutputStream * new_encoding_stream (
+        const char * filename,
+        google::protobuf::io::ZeroCopyOutputStream * output)
+{
+    static_cast<void>(output);  // unused if built without codecs
+    if (endswith(filename, ".zst")) {
+#ifdef LOOM_USE_ZSTD
+        return new ZstdOutputStream(output);
+#endif // LOOM_USE_ZSTD
+        LOOM_ERROR("loom was built without zstd support: " << filename);
+    } else if (endswith(filename, ".lz4")) {
+#ifdef LOOM_USE_LZ4
+        return new Lz4OutputStream(output);
+#endif // LOOM_USE_LZ4
+        LOOM_ERROR("loom was built without lz4 support: " << filename);
+    }
+    return nullptr;
+}
+
+} // namespace protobuf
+} // namespace loom
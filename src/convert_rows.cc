@@ -0,0 +1,105 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/args.hpp>
+#include <loom/protobuf_stream.hpp>
+
+const char * help_message =
+"Usage: convert_rows SCHEMA_ROW_IN ROWS_IN ROWS_OUT [ROWS_PER_CHUNK=1024]"
+" [MODEL_IN]"
+"\nArguments:"
+"\n  SCHEMA_ROW_IN   filename of schema row (e.g. schema.pb.gz)"
+"\n  ROWS_IN         filename of input dataset stream (e.g. rows.pbs.gz)"
+"\n  ROWS_OUT        filename of output dataset stream (e.g. rows.pbc.gz)"
+"\n  ROWS_PER_CHUNK  number of rows per chunk of a columnar ROWS_OUT"
+"\n  MODEL_IN        filename of model (e.g. model.pb.gz) whose kinds"
+"\n                  group the columns of a columnar ROWS_OUT"
+"\nNotes:"
+"\n  Any filename can end with .gz to indicate gzip compression."
+"\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
+"\n  Row files named like *.pbc or *.pbc.gz are stored column-wise,"
+"\n  and either side of the conversion can be columnar."
+;
+
+int main (int argc, char ** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    Args args(argc, argv, help_message);
+    const char * schema_row_in = args.pop();
+    const char * rows_in = args.pop();
+    const char * rows_out = args.pop();
+    const int rows_per_chunk = args.pop_default(1024);
+    const char * model_in = args.pop_default(nullptr);
+    args.done();
+
+    LOOM_ASSERT_LT(0, rows_per_chunk);
+
+    ::protobuf::loom::ProductValue value;
+    loom::protobuf::InFile(schema_row_in).read(value);
+
+    loom::protobuf::InFile rows(rows_in);
+    loom::protobuf::OutFile converted(rows_out);
+    ::protobuf::loom::Row row;
+
+    if (loom::protobuf::is_row_chunks(rows_out)) {
+        loom::protobuf::RowChunkEncoder::Groups groups;
+        if (model_in) {
+            ::protobuf::loom::CrossCat model;
+            loom::protobuf::InFile(model_in).read(model);
+            for (const auto & kind : model.kinds()) {
+                groups.push_back(std::vector<uint32_t>(
+                    kind.featureids().begin(),
+                    kind.featureids().end()));
+            }
+        }
+        loom::protobuf::RowChunkEncoder encoder(
+            value.booleans_size(),
+            value.counts_size(),
+            value.reals_size(),
+            groups);
+        loom::protobuf::RowChunk chunk;
+        while (rows.try_read_stream(row)) {
+            encoder.add(row);
+            if (encoder.size() == static_cast<size_t>(rows_per_chunk)) {
+                encoder.encode(chunk);
+                converted.write_stream(chunk);
+            }
+        }
+        if (encoder.size()) {
+            encoder.encode(chunk);
+            converted.write_stream(chunk);
+        }
+    } else {
+        while (rows.try_read_stream(row)) {
+            converted.write_stream(row);
+        }
+    }
+
+    return 0;
+}
@@ -31,6 +31,7 @@
 #include <distributions/io/protobuf.hpp>
 #include <loom/protobuf_stream.hpp>
 #include <loom/store.hpp>
+#include <loom/snapshot.hpp>
 #include <loom/cross_cat.hpp>
 #include <loom/infer_grid.hpp>
 
@@ -52,7 +53,22 @@ void CrossCat::model_load (const char * filename)
 {
     protobuf::CrossCat message;
     protobuf::InFile(filename).read(message);
+    _model_load(message);
+}
+
+void CrossCat::model_load (const Snapshot & snapshot)
+{
+    protobuf::CrossCat message;
+    const size_t section = Snapshot::model_section();
+    bool success = message.ParseFromArray(
+        snapshot.section_data(section),
+        snapshot.section_size(section));
+    LOOM_ASSERT(success, "failed to parse model from " << snapshot.filename());
+    _model_load(message);
+}
 
+void CrossCat::_model_load (const protobuf::CrossCat & message)
+{
     schema.clear();
     tares.clear();
     featureid_to_kindid.clear();
@@ -150,6 +166,38 @@ void CrossCat::mixture_load (
         const char * dirname,
         size_t empty_group_count,
         rng_t & rng)
+{
+    _mixture_load([&](Kind & kind, size_t kindid){
+        std::string filename = store::get_mixture_path(dirname, kindid);
+        kind.mixture.load_step_1_of_3(
+            kind.model,
+            filename.c_str(),
+            empty_group_count);
+    }, empty_group_count, rng);
+}
+
+void CrossCat::mixture_load (
+        const Snapshot & snapshot,
+        size_t empty_group_count,
+        rng_t & rng)
+{
+    LOOM_ASSERT_EQ(
+        snapshot.section_count(),
+        Snapshot::groups_section(kinds.size()));
+    _mixture_load([&](Kind & kind, size_t kindid){
+        const size_t section = Snapshot::groups_section(kindid);
+        protobuf::InBuffer groups(
+            snapshot.section_data(section),
+            snapshot.section_size(section));
+        kind.mixture.load_step_1_of_3(kind.model, groups, empty_group_count);
+    }, empty_group_count, rng);
+}
+
+template<class LoadGroups>
+void CrossCat::_mixture_load (
+        const LoadGroups & load_groups,
+        size_t empty_group_count,
+        rng_t & rng)
 {
     const size_t kind_count = kinds.size();
     const size_t feature_count = featureid_to_kindid.size();
@@ -157,14 +205,9 @@ void CrossCat::mixture_load (
 
     #pragma omp parallel for schedule(dynamic, 1)
     for (size_t kindid = 0; kindid < kind_count; ++kindid) {
-        rng_t rng(seed + kindid);
         Kind & kind = kinds[kindid];
-        std::string filename = store::get_mixture_path(dirname, kindid);
         kind.mixture.maintaining_cache = true;
-        kind.mixture.load_step_1_of_3(
-            kind.model,
-            filename.c_str(),
-            empty_group_count);
+        load_groups(kind, kindid);
     }
     seed += kind_count;
 
@@ -181,6 +224,15 @@ void CrossCat::mixture_load (
     }
     seed += feature_count;
 
+    // score columns do not depend on tares, which are usually loaded later
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        rng_t rng(seed + kindid);
+        auto & kind = kinds[kindid];
+        kind.mixture.init_score_columns(kind.model, rng);
+    }
+    seed += kind_count;
+
     if (not tares.empty()) {
         #pragma omp parallel for schedule(dynamic, 1)
         for (size_t kindid = 0; kindid < kind_count; ++kindid) {
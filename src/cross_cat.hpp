@@ -38,6 +38,8 @@
 namespace loom
 {
 
+class Snapshot;
+
 struct CrossCat : noncopyable
 {
     typedef FastProductMixture ProductMixture;
@@ -57,6 +59,7 @@ struct CrossCat : noncopyable
     std::vector<uint32_t> featureid_to_kindid;
 
     void model_load (const char * filename);
+    void model_load (const Snapshot & snapshot);
     void model_dump (const char * filename) const;
 
     void tares_load (const char * filename, rng_t & rng);
@@ -68,6 +71,10 @@ struct CrossCat : noncopyable
             const char * dirname,
             size_t empty_group_count,
             rng_t & rng);
+    void mixture_load (
+            const Snapshot & snapshot,
+            size_t empty_group_count,
+            rng_t & rng);
     void mixture_dump (
             const char * dirname,
             const std::vector<std::vector<uint32_t>> & sorted_to_globals) const;
@@ -84,6 +91,16 @@ struct CrossCat : noncopyable
     float score_data (rng_t & rng) const;
 
     void validate () const;
+
+private:
+
+    void _model_load (const protobuf::CrossCat & message);
+
+    template<class LoadGroups>
+    void _mixture_load (
+            const LoadGroups & load_groups,
+            size_t empty_group_count,
+            rng_t & rng);
 };
 
 inline void CrossCat::simplify (
@@ -0,0 +1,163 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <loom/common.hpp>
+#include <loom/product_value.hpp>
+
+namespace loom
+{
+
+// A bounded cache of split rows keyed by their position in the row stream,
+// filled as the unassigned cursor adds rows and drained as the assigned
+// cursor later removes them.  Entries stay valid only while the splitter
+// is fixed, i.e. for the lifetime of one CatPipeline.
+//
+// Popped entries hand their buffers to the caller in exchange for the
+// caller's old buffers, which are pooled and reused by later inserts.
+// In steady state, diffs therefore cycle between tasks and the cache
+// without reallocating their repeated fields.
+class DiffCache : noncopyable
+{
+public:
+
+    typedef std::vector<ProductValue::Diff> Diffs;
+
+    DiffCache (uint64_t row_count, size_t capacity_bytes) :
+        row_count_(row_count),
+        capacity_bytes_(capacity_bytes),
+        size_bytes_(0)
+    {
+        pool_.reserve(max_pool_size);
+    }
+
+    bool enabled () const { return capacity_bytes_ > 0; }
+
+    // positions are as reported by InFile::position() after a read
+    uint64_t next_position (uint64_t position) const
+    {
+        return position % row_count_ + 1;
+    }
+
+    bool try_insert (uint64_t position, uint64_t rowid, const Diffs & diffs)
+    {
+        Entry entry;
+        entry.rowid = rowid;
+        entry.bytes = sizeof(Entry);
+        for (const auto & diff : diffs) {
+            entry.bytes += diff.SpaceUsed();
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (not fits(position, entry.bytes)) {
+                return false;
+            }
+            if (not pool_.empty()) {
+                std::swap(entry.partial_diffs, pool_.back());
+                pool_.pop_back();
+            }
+        }
+
+        const size_t diff_count = diffs.size();
+        entry.partial_diffs.resize(diff_count);
+        for (size_t i = 0; i < diff_count; ++i) {
+            entry.partial_diffs[i].CopyFrom(diffs[i]);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (not fits(position, entry.bytes)) {
+            recycle(entry.partial_diffs);
+            return false;
+        }
+        auto pair = entries_.insert(std::make_pair(position, Entry()));
+        Entry & cached = pair.first->second;
+        size_bytes_ -= cached.bytes;
+        size_bytes_ += entry.bytes;
+        std::swap(cached, entry);
+        recycle(entry.partial_diffs);
+        return true;
+    }
+
+    bool try_pop (uint64_t position, uint64_t & rowid, Diffs & diffs)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto i = entries_.find(position);
+        if (i == entries_.end()) {
+            return false;
+        }
+        Entry & entry = i->second;
+        rowid = entry.rowid;
+        std::swap(diffs, entry.partial_diffs);
+        recycle(entry.partial_diffs);
+        size_bytes_ -= entry.bytes;
+        entries_.erase(i);
+        return true;
+    }
+
+private:
+
+    enum { max_pool_size = 256 };
+
+    // requires mutex_ to be held; counts any entry replaced at position
+    bool fits (uint64_t position, size_t bytes) const
+    {
+        auto i = entries_.find(position);
+        const size_t replaced = i == entries_.end() ? 0 : i->second.bytes;
+        return size_bytes_ - replaced + bytes <= capacity_bytes_;
+    }
+
+    // requires mutex_ to be held
+    void recycle (Diffs & diffs)
+    {
+        if (pool_.size() < max_pool_size) {
+            pool_.resize(pool_.size() + 1);
+            std::swap(pool_.back(), diffs);
+        }
+    }
+
+    struct Entry
+    {
+        uint64_t rowid;
+        Diffs partial_diffs;
+        size_t bytes;
+
+        Entry () : rowid(0), bytes(0) {}
+    };
+
+    const uint64_t row_count_;
+    const size_t capacity_bytes_;
+    size_t size_bytes_;
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    std::vector<Diffs> pool_;
+};
+
+} // namespace loom
@@ -164,7 +164,7 @@ void Differ::compress_rows (
             std::string(rows_in) != std::string(diffs_out),
             "in-place sparsify is not supported");
     }
-    protobuf::OutFile diffs(diffs_out);
+    protobuf::OutFile diffs(diffs_out, protobuf::OutFile::BLOCK_GZIP);
     protobuf::Row abs;
     protobuf::Row rel;
     ProductValue actual;
@@ -49,7 +49,7 @@ void generate_rows (
     VectorFloat scores;
     std::vector<ProductModel::Value> partial_values(kind_count);
     protobuf::Row row;
-    protobuf::OutFile rows(rows_out);
+    protobuf::OutFile rows(rows_out, protobuf::OutFile::BLOCK_GZIP);
 
     for (auto & kind : cross_cat.kinds) {
         kind.model.realize(rng);
@@ -41,12 +41,14 @@ KindKernel::KindKernel (
     empty_kind_count_(config.kind().empty_kind_count()),
     iterations_(config.kind().iterations()),
     score_parallel_(config.kind().score_parallel()),
+    row_parallel_(config.kind().row_parallel()),
 
     cross_cat_(cross_cat),
     assignments_(assignments),
     kind_proposer_(),
     partial_diffs_(),
     scores_(),
+    kind_scores_(),
     rng_(seed),
 
     total_count_(0),
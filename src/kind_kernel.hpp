@@ -98,6 +98,7 @@ private:
     const size_t empty_kind_count_;
     const size_t iterations_;
     const bool score_parallel_;
+    const bool row_parallel_;
 
     CrossCat & cross_cat_;
     Assignments & assignments_;
@@ -105,6 +106,7 @@ private:
     std::vector<ProductValue::Diff> partial_diffs_;
     std::vector<ProductValue *> temp_values_;
     VectorFloat scores_;
+    std::vector<VectorFloat> kind_scores_;
     rng_t rng_;
 
     size_t total_count_;
@@ -156,9 +158,25 @@ inline void KindKernel::add_row (const protobuf::Row & row)
 
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
-    for (size_t i = 0; i < kind_count; ++i) {
-        auto groupid = add_to_cross_cat(i, partial_diffs_[i], scores_, rng_);
-        add_to_kind_proposer(i, groupid, row.diff(), rng_);
+    if (row_parallel_ and kind_count > 1) {
+        kind_scores_.resize(kind_count);
+        const auto seed = rng_();
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = 0; i < kind_count; ++i) {
+            rng_t rng(seed + i);
+            auto groupid =
+                add_to_cross_cat(i, partial_diffs_[i], kind_scores_[i], rng);
+            add_to_kind_proposer(i, groupid, row.diff(), rng);
+        }
+
+    } else {
+
+        for (size_t i = 0; i < kind_count; ++i) {
+            auto groupid =
+                add_to_cross_cat(i, partial_diffs_[i], scores_, rng_);
+            add_to_kind_proposer(i, groupid, row.diff(), rng_);
+        }
     }
 }
 
@@ -175,7 +193,10 @@ inline size_t KindKernel::add_to_cross_cat (
 
     size_t groupid;
     if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
+        FlatValue & value = thread_local_flat_value(
+            model.schema,
+            model.features,
+            partial_diff.pos());
         model.add_value(value, rng);
         mixture.score_value(model, value, scores, rng);
         groupid = sample_from_scores_overwrite(rng, scores);
@@ -230,9 +251,22 @@ inline void KindKernel::remove_row (const protobuf::Row & row)
 
     cross_cat_.splitter.split(row.diff(), partial_diffs_);
     cross_cat_.simplify(partial_diffs_);
-    for (size_t i = 0; i < kind_count; ++i) {
-        auto groupid = remove_from_cross_cat(i, partial_diffs_[i], rng_);
-        remove_from_kind_proposer(i, groupid);
+    if (row_parallel_ and kind_count > 1) {
+        const auto seed = rng_();
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = 0; i < kind_count; ++i) {
+            rng_t rng(seed + i);
+            auto groupid = remove_from_cross_cat(i, partial_diffs_[i], rng);
+            remove_from_kind_proposer(i, groupid);
+        }
+
+    } else {
+
+        for (size_t i = 0; i < kind_count; ++i) {
+            auto groupid = remove_from_cross_cat(i, partial_diffs_[i], rng_);
+            remove_from_kind_proposer(i, groupid);
+        }
     }
 }
 
@@ -249,7 +283,10 @@ inline size_t KindKernel::remove_from_cross_cat (
     auto global_groupid = assignments_.groupids(kindid).pop();
     auto groupid = mixture.id_tracker.global_to_packed(global_groupid);
     if (cross_cat_.tares.empty()) {
-        auto & value = partial_diff.pos();
+        FlatValue & value = thread_local_flat_value(
+            model.schema,
+            model.features,
+            partial_diff.pos());
         mixture.remove_value(model, groupid, value, rng);
         model.remove_value(value, rng);
     } else {
@@ -38,15 +38,21 @@ KindPipeline::KindPipeline (
         Assignments & assignments,
         KindKernel & kind_kernel,
         rng_t & rng) :
-    pipeline_(config.row_queue_capacity(), stage_count),
+    pipeline_(
+        config.row_queue_capacity(),
+        stage_count,
+        config.spin_count(),
+        config.row_batch_size()),
     cross_cat_(cross_cat),
     rows_(rows),
     assignments_(assignments),
     kind_kernel_(kind_kernel),
-    kind_count_(0),
+    kinds_(),
+    schedule_(),
     rng_(rng)
 {
-    start_threads(config.parser_threads());
+    update_schedule();
+    start_threads(config.parser_threads(), config.kind_threads());
 }
 
 template<class Fun>
@@ -59,7 +65,7 @@ inline void KindPipeline::add_thread (
     pipeline_.unsafe_add_thread(stage_number, thread, fun);
 }
 
-void KindPipeline::start_threads (size_t parser_threads)
+void KindPipeline::start_threads (size_t parser_threads, size_t kind_threads)
 {
     // unzip
     add_thread(0, [this](Task & task, const ThreadState &){
@@ -100,43 +106,116 @@ void KindPipeline::start_threads (size_t parser_threads)
             }
         }
     });
-    start_kind_threads();
+
+    // add/remove, on a fixed pool of workers that claim whole kinds
+    if (kind_threads == 0) {
+        kind_threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < kind_threads; ++i) {
+        ThreadState init_thread;
+        init_thread.rng.seed(rng_());
+        pipeline_.unsafe_add_batch_thread(2, init_thread,
+            [this](size_t position, Task * begin, Task * end,
+                   ThreadState & thread){
+            process_kinds(position, begin, end, thread);
+        });
+    }
 
     pipeline_.validate();
 }
 
-void KindPipeline::start_kind_threads ()
+// This must be called while the pipeline is drained.
+// Heaviest kinds are claimed first, so that they start early in each batch.
+void KindPipeline::update_schedule ()
+{
+    const size_t kind_count = cross_cat_.kinds.size();
+    if (kinds_.size() != kind_count) {
+        std::vector<KindState> kinds(kind_count);
+        for (size_t i = 0; i < std::min(kind_count, kinds_.size()); ++i) {
+            kinds[i].cost = kinds_[i].cost;
+        }
+        kinds_.swap(kinds);
+    }
+    const size_t position = pipeline_.unsafe_position();
+    for (auto & kind : kinds_) {
+        kind.position.store(position, std::memory_order_relaxed);
+    }
+
+    schedule_.resize(kind_count);
+    for (size_t i = 0; i < kind_count; ++i) {
+        schedule_[i] = i;
+    }
+    std::stable_sort(schedule_.begin(), schedule_.end(),
+        [this](size_t lhs, size_t rhs){
+        return kinds_[lhs].cost > kinds_[rhs].cost;
+    });
+    for (auto & kind : kinds_) {
+        kind.cost /= 2;
+    }
+}
+
+// Workers claim kinds from a counter shared by the batch. A kind still busy
+// with the previous batch is deferred until all other claims are done.
+void KindPipeline::process_kinds (
+        size_t position,
+        Task * begin,
+        Task * end,
+        ThreadState & thread)
 {
-    while (kind_count_ < cross_cat_.kinds.size()) {
-        size_t i = kind_count_++;
-
-        // add/remove
-        add_thread(2, [i, this](const Task & task, ThreadState & thread){
-            if (LOOM_LIKELY(i < cross_cat_.kinds.size())) {
-                if (task.add) {
-
-                    auto groupid = kind_kernel_.add_to_cross_cat(
-                        i,
-                        task.partial_diffs[i],
-                        thread.scores,
-                        thread.rng);
-                    kind_kernel_.add_to_kind_proposer(
-                        i,
-                        groupid,
-                        task.row.diff(),
-                        thread.rng);
-
-                } else {
-
-                    auto groupid = kind_kernel_.remove_from_cross_cat(
-                        i,
-                        task.partial_diffs[i],
-                        thread.rng);
-                    kind_kernel_.remove_from_kind_proposer(i, groupid);
-                }
+    const size_t kind_count = schedule_.size();
+    std::atomic<size_t> & next_kind = begin->next_kind;
+    thread.deferred_kinds.clear();
+    for (size_t k; (k = next_kind.fetch_add(1)) < kind_count;) {
+        const size_t i = schedule_[k];
+        if (kinds_[i].position.load(std::memory_order_acquire) == position) {
+            process_kind(i, position, begin, end, thread);
+        } else {
+            thread.deferred_kinds.push_back(i);
+        }
+    }
+    for (size_t i : thread.deferred_kinds) {
+        while (kinds_[i].position.load(std::memory_order_acquire) != position) {
+            std::this_thread::yield();
+        }
+        process_kind(i, position, begin, end, thread);
+    }
+}
+
+void KindPipeline::process_kind (
+        size_t i,
+        size_t position,
+        Task * begin,
+        Task * end,
+        ThreadState & thread)
+{
+    KindState & kind = kinds_[i];
+    {
+        TimedScope timer(kind.cost);
+        for (const Task * task = begin; task != end; ++task) {
+            if (task->add) {
+
+                auto groupid = kind_kernel_.add_to_cross_cat(
+                    i,
+                    task->partial_diffs[i],
+                    thread.scores,
+                    thread.rng);
+                kind_kernel_.add_to_kind_proposer(
+                    i,
+                    groupid,
+                    task->row.diff(),
+                    thread.rng);
+
+            } else {
+
+                auto groupid = kind_kernel_.remove_from_cross_cat(
+                    i,
+                    task->partial_diffs[i],
+                    thread.rng);
+                kind_kernel_.remove_from_kind_proposer(i, groupid);
             }
-        });
+        }
     }
+    kind.position.store(position + 1, std::memory_order_release);
 }
 
 } // namespace loom
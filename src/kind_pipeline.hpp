@@ -30,6 +30,7 @@
 
 #include <thread>
 #include <loom/common.hpp>
+#include <loom/timer.hpp>
 #include <loom/cross_cat.hpp>
 #include <loom/assignments.hpp>
 #include <loom/stream_interval.hpp>
@@ -55,12 +56,18 @@ public:
 
     void add_row ()
     {
-        pipeline_.start([](Task & task){ task.add = true; });
+        pipeline_.start([](Task & task){
+            task.add = true;
+            task.next_kind.store(0, std::memory_order_relaxed);
+        });
     }
 
     void remove_row ()
     {
-        pipeline_.start([](Task & task){ task.add = false; });
+        pipeline_.start([](Task & task){
+            task.add = false;
+            task.next_kind.store(0, std::memory_order_relaxed);
+        });
     }
 
     void wait ()
@@ -71,10 +78,7 @@ public:
     bool try_run ()
     {
         bool changed = kind_kernel_.try_run();
-        if (changed) {
-            start_kind_threads();
-            pipeline_.validate();
-        }
+        update_schedule();
         return changed;
     }
 
@@ -93,32 +97,56 @@ private:
     struct Task
     {
         std::atomic_flag parsed;
+        std::atomic<size_t> next_kind;  // kind claims, in a batch's first task
         bool add;
-        std::vector<char> raw;
+        protobuf::RawMessage raw;
         protobuf::Row row;
         std::vector<ProductValue::Diff> partial_diffs;
 
-        Task () : parsed(ATOMIC_FLAG_INIT) {}
+        Task () : parsed(ATOMIC_FLAG_INIT), next_kind(0) {}
     };
 
     struct ThreadState
     {
         rng_t rng;
         VectorFloat scores;
+        std::vector<size_t> deferred_kinds;
+    };
+
+    // Each kind processes batches in queue order, one batch at a time,
+    // but successive batches of one kind may run on different workers.
+    struct KindState
+    {
+        std::atomic<size_t> position;  // next queue position to process
+        usec_t cost;                   // decaying sum of processing time
+
+        KindState () : position(0), cost(0) {}
     };
 
     template<class Fun>
     void add_thread (size_t stage_number, const Fun & fun);
 
-    void start_threads (size_t parser_threads);
-    void start_kind_threads ();
+    void start_threads (size_t parser_threads, size_t kind_threads);
+    void update_schedule ();
+    void process_kinds (
+            size_t position,
+            Task * begin,
+            Task * end,
+            ThreadState & thread);
+    void process_kind (
+            size_t i,
+            size_t position,
+            Task * begin,
+            Task * end,
+            ThreadState & thread);
 
     Pipeline<Task, ThreadState> pipeline_;
     CrossCat & cross_cat_;
     StreamInterval & rows_;
     Assignments & assignments_;
     KindKernel & kind_kernel_;
-    size_t kind_count_;
+    std::vector<KindState> kinds_;
+    std::vector<size_t> schedule_;
     rng_t & rng_;
 };
 
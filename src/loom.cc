@@ -26,6 +26,7 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <memory>
 #include <loom/loom.hpp>
 #include <loom/cat_kernel.hpp>
 #include <loom/cat_pipeline.hpp>
@@ -34,6 +35,7 @@
 #include <loom/kind_pipeline.hpp>
 #include <loom/stream_interval.hpp>
 #include <loom/generate.hpp>
+#include <loom/snapshot.hpp>
 
 namespace loom
 {
@@ -47,12 +49,20 @@ Loom::Loom (
         const char * model_in,
         const char * groups_in,
         const char * assign_in,
-        const char * tares_in) :
+        const char * tares_in,
+        const char * snapshot_in) :
     config_(config),
     cross_cat_(),
     assignments_()
 {
-    cross_cat_.model_load(model_in);
+    // a snapshot, if given, replaces both model_in and groups_in
+    std::unique_ptr<Snapshot> snapshot(
+        snapshot_in ? new Snapshot(snapshot_in) : nullptr);
+    if (snapshot) {
+        cross_cat_.model_load(* snapshot);
+    } else {
+        cross_cat_.model_load(model_in);
+    }
     const size_t kind_count = cross_cat_.kinds.size();
     LOOM_ASSERT(kind_count, "no kinds, loom is empty");
     assignments_.init(kind_count);
@@ -60,11 +70,14 @@ Loom::Loom (
     const size_t empty_group_count =
         config_.kernels().cat().empty_group_count();
     LOOM_ASSERT_LT(0, empty_group_count);
-    if (groups_in) {
+    if (snapshot and groups_in) {
+        cross_cat_.mixture_load(* snapshot, empty_group_count, rng);
+    } else if (groups_in) {
         cross_cat_.mixture_load(groups_in, empty_group_count, rng);
     } else {
         cross_cat_.mixture_init_unobserved(empty_group_count, rng);
     }
+    snapshot.reset();
 
     if (tares_in) {
         cross_cat_.tares_load(tares_in, rng);
@@ -121,7 +134,9 @@ void Loom::infer_single_pass (
 
     if (assign_out) {
 
-        protobuf::OutFile assignments(assign_out);
+        protobuf::OutFile assignments(
+            assign_out,
+            protobuf::OutFile::BLOCK_GZIP);
         protobuf::Assignment assignment;
 
         while (rows.try_read_stream(row)) {
@@ -171,7 +186,7 @@ void Loom::infer_multi_pass (
         const char * checkpoint_in,
         const char * checkpoint_out)
 {
-    StreamInterval rows(rows_in);
+    StreamInterval rows(rows_in, config_.rows().readahead_depth());
     CombinedSchedule schedule(config_.schedule());
     schedule.annealing.set_extra_passes(
         schedule.accelerating.extra_passes(assignments_.row_count()));
@@ -405,7 +420,11 @@ bool Loom::infer_cat_structure_parallel (
         rows,
         assignments_,
         cat_kernel,
-        rng);
+        rng,
+        checkpoint.row_count(),
+        config_.kernels().cat().row_cache()
+            ? config_.kernels().cat().row_cache_bytes()
+            : 0);
 
     size_t row_count = assignments_.row_count();
     while (LOOM_LIKELY(row_count != checkpoint.row_count())) {
@@ -53,7 +53,8 @@ public:
             const char * model_in,
             const char * groups_in = nullptr,
             const char * assign_in = nullptr,
-            const char * tares_in = nullptr);
+            const char * tares_in = nullptr,
+            const char * snapshot_in = nullptr);
 
     void dump (
             const char * model_out = nullptr,
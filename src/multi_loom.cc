@@ -28,11 +28,27 @@
 
 #include <fstream>
 #include <loom/store.hpp>
+#include <loom/snapshot.hpp>
 #include <loom/multi_loom.hpp>
 
 namespace loom
 {
 
+// A snapshot is used only if its model and groups files are unchanged
+// since it was made, so that a re-inferred sample is never shadowed.
+static const char * find_snapshot (const store::Paths::Sample & paths)
+{
+    if (Snapshot::is_current(
+            paths.snapshot.c_str(),
+            paths.model.c_str(),
+            paths.groups.c_str()))
+    {
+        return paths.snapshot.c_str();
+    } else {
+        return nullptr;
+    }
+}
+
 struct MultiLoom::Sample
 {
     protobuf::Config config;
@@ -51,7 +67,8 @@ struct MultiLoom::Sample
             paths.model.c_str(),
             load_groups ? paths.groups.c_str() : nullptr,
             load_assign ? paths.assign.c_str() : nullptr,
-            tares_in)
+            tares_in,
+            find_snapshot(paths))
     {
     }
 };
@@ -29,19 +29,26 @@
 #pragma once
 
 #include <atomic>
-#include <mutex>
+#include <climits>
 #include <thread>
-#include <condition_variable>
 #include <distributions/aligned_allocator.hpp>
 #include <loom/common.hpp>
 
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif // __linux__
+
 #ifdef LOOM_ASSUME_X86
 #  define load_barrier() asm volatile("lfence":::"memory")
 #  define store_barrier() asm volatile("sfence":::"memory")
+#  define cpu_relax() asm volatile("pause":::"memory")
 #else // LOOM_ASSUME_X86
 #  warn "defaulting to full memory barriers"
 #  define load_barrier() __sync_synchronize()
 #  define store_barrier() __sync_synchronize()
+#  define cpu_relax() asm volatile("":::"memory")
 #endif // LOOM_ASSUME_X86
 
 #if 0
@@ -53,36 +60,40 @@
 namespace loom
 {
 
+// The (stage, count) pair fits in one 32-bit word, so that waiters can
+// park on the word itself via futex. Bit 15 marks that a waiter is parked.
 class PipelineState
 {
-    std::atomic<uint_fast64_t> pair_;
+    // waiters mark and park on const states
+    mutable std::atomic<uint32_t> pair_;
 
 public:
 
     enum {
-        max_stage_count = 48,
-        max_consumer_count = 65535
+        max_stage_count = 16,
+        max_consumer_count = 32767,
+        waiting_flag = 0x8000
     };
 
-    typedef uint_fast64_t stage_t;
-    typedef uint_fast64_t count_t;
-    typedef uint_fast64_t pair_t;
+    typedef uint32_t stage_t;
+    typedef uint32_t count_t;
+    typedef uint32_t pair_t;
 
-    static pair_t create_state (uint_fast64_t stage_number, count_t count)
+    static pair_t create_state (uint32_t stage_number, count_t count)
     {
         LOOM_ASSERT_LT(stage_number, max_stage_count);
-        LOOM_ASSERT_LE(count, 0xFFFFUL);
+        LOOM_ASSERT_LE(count, max_consumer_count);
         return _state(stage_number, count);
     }
 
     static constexpr stage_t get_stage (const pair_t & pair)
     {
-        return pair & 0xFFFFFFFFFFFF0000UL;
+        return pair & 0xFFFF0000U;
     }
 
     static constexpr count_t get_count (const pair_t & pair)
     {
-        return pair & 0xFFFFUL;
+        return pair & 0x7FFFU;
     }
 
     PipelineState () : pair_(0)
@@ -90,14 +101,19 @@ public:
         static_test();
     }
 
+    pair_t load () const
+    {
+        return pair_.load(std::memory_order_acquire);
+    }
+
     stage_t load_stage () const
     {
-        return get_stage(pair_.load(std::memory_order_acquire));
+        return get_stage(load());
     }
 
     count_t load_count () const
     {
-        return get_count(pair_.load(std::memory_order_acquire));
+        return get_count(load());
     }
 
     void store (const pair_t & pair)
@@ -110,11 +126,58 @@ public:
         return get_count(pair_.fetch_sub(1, std::memory_order_acq_rel));
     }
 
+    // returns the previous pair, including its waiting_flag
+    pair_t exchange (const pair_t & pair)
+    {
+        return pair_.exchange(pair, std::memory_order_acq_rel);
+    }
+
+    bool try_mark_waiting (pair_t expected) const
+    {
+        return (expected & waiting_flag) or pair_.compare_exchange_strong(
+            expected,
+            expected | waiting_flag,
+            std::memory_order_acq_rel);
+    }
+
+    // blocks until woken, unless the pair no longer equals expected
+    void wait (pair_t expected) const
+    {
+#ifdef __linux__
+        syscall(
+            SYS_futex,
+            & pair_,
+            FUTEX_WAIT_PRIVATE,
+            expected,
+            nullptr,
+            nullptr,
+            0);
+#else // __linux__
+        if (pair_.load(std::memory_order_relaxed) == expected) {
+            std::this_thread::yield();
+        }
+#endif // __linux__
+    }
+
+    void wake_all ()
+    {
+#ifdef __linux__
+        syscall(
+            SYS_futex,
+            & pair_,
+            FUTEX_WAKE_PRIVATE,
+            INT_MAX,
+            nullptr,
+            nullptr,
+            0);
+#endif // __linux__
+    }
+
 private:
 
-    static constexpr pair_t _state (uint_fast64_t stage_number, count_t count)
+    static constexpr pair_t _state (uint32_t stage_number, count_t count)
     {
-        return (0x10000UL << stage_number) | count;
+        return (0x10000U << stage_number) | count;
     }
 
     static void static_test ()
@@ -124,6 +187,10 @@ private:
         static_assert(get_count(_state(2, 1234)) == 1234, "fail");
         static_assert(get_count(_state(3, 1234)) == 1234, "fail");
         static_assert(get_count(_state(4, 1234)) == 1234, "fail");
+        static_assert(get_count(_state(4, 1234) | waiting_flag) == 1234,
+                      "fail");
+        static_assert(get_stage(_state(4, 1234) | waiting_flag) ==
+                      get_stage(_state(4, 0)), "fail");
 
         static_assert(get_stage(_state(0, 1234)) ==
                       get_stage(_state(0, 5679)), "fail");
@@ -144,33 +211,44 @@ private:
         static_assert(_state(2, 1234) != _state(3, 1234), "fail");
         static_assert(_state(2, 1234) != _state(4, 1234), "fail");
         static_assert(_state(3, 1234) != _state(4, 1234), "fail");
+        static_assert(
+            sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+            "futex requires a plain 32-bit word");
     }
 };
 
+// Waiters spin briefly, then park on the envelope's state word.
+// Releasers only pay for a wake syscall when a waiter is parked there.
 class PipelineGuard
 {
     PipelineState::pair_t state_;
     PipelineState::stage_t stage_;
-    std::mutex mutex_;
-    std::condition_variable cond_variable_;
+    size_t spin_count_;
 
 public:
 
-    void init (size_t stage_number, size_t count)
+    enum { default_spin_count = 256 };
+
+    PipelineGuard () :
+        state_(0),
+        stage_(0),
+        spin_count_(default_spin_count)
+    {
+    }
+
+    void init (size_t stage_number, size_t count, size_t spin_count)
     {
         state_ = PipelineState::create_state(stage_number, count);
         stage_ = PipelineState::create_state(stage_number, 0);
+        spin_count_ = spin_count;
     }
 
     size_t get_count () { return PipelineState::get_count(state_); }
 
     void acquire (const PipelineState & state)
     {
-        if (state.load_stage() != stage_) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            cond_variable_.wait(lock, [&](){
-                return state.load_stage() == stage_;
-            });
+        if (LOOM_UNLIKELY(state.load_stage() != stage_)) {
+            _wait(state);
         }
         load_barrier();
     }
@@ -179,9 +257,9 @@ public:
     {
         store_barrier();
         if (state.decrement_count() == 1) {
-            state.store(state_);
-            std::unique_lock<std::mutex> lock(mutex_);
-            cond_variable_.notify_all();
+            if (state.exchange(state_) & PipelineState::waiting_flag) {
+                state.wake_all();
+            }
         }
     }
 
@@ -194,6 +272,28 @@ public:
     {
         LOOM_ASSERT2(state.load_stage() == stage_, "state is not ready");
     }
+
+private:
+
+    void _wait (const PipelineState & state)
+    {
+        for (size_t i = 0; i < spin_count_; ++i) {
+            cpu_relax();
+            if (state.load_stage() == stage_) {
+                return;
+            }
+        }
+
+        for (;;) {
+            PipelineState::pair_t pair = state.load();
+            if (PipelineState::get_stage(pair) == stage_) {
+                break;
+            }
+            if (state.try_mark_waiting(pair)) {
+                state.wait(pair | PipelineState::waiting_flag);
+            }
+        }
+    }
 };
 
 namespace detail
@@ -234,6 +334,7 @@ class PipelineQueue
     std::vector<Envelope, Alloc> envelopes_;
     const size_t size_plus_one_;
     const size_t stage_count_;
+    const size_t spin_count_;
     std::vector<size_t> consumer_counts_;
     size_t position_;
     PipelineGuard guards_[PipelineState::max_stage_count];
@@ -255,10 +356,11 @@ class PipelineQueue
 
 public:
 
-    PipelineQueue (size_t size, size_t stage_count) :
+    PipelineQueue (size_t size, size_t stage_count, size_t spin_count) :
         envelopes_(size + 1),
         size_plus_one_(size + 1),
         stage_count_(stage_count),
+        spin_count_(spin_count),
         consumer_counts_(stage_count, 0),
         position_(0),
         guards_()
@@ -267,9 +369,9 @@ public:
         LOOM_ASSERT_LE(1 + stage_count_, PipelineState::max_stage_count);
 
         for (size_t i = 0; i < stage_count_; ++i) {
-            guards_[i].init(i, 0);
+            guards_[i].init(i, 0, spin_count_);
         }
-        guards_[stage_count_].init(stage_count_, 1);
+        guards_[stage_count_].init(stage_count_, 1, spin_count_);
 
         PipelineGuard & guard = guards_[stage_count_];
         for (size_t i = 0; i < size_plus_one_; ++i) {
@@ -299,7 +401,7 @@ public:
         LOOM_ASSERT_LT(stage_number, stage_count_);
         assert_ready();
         size_t count = ++consumer_counts_[stage_number];
-        guards_[stage_number].init(stage_number, count);
+        guards_[stage_number].init(stage_number, count, spin_count_);
         assert_ready();
     }
 
@@ -325,21 +427,33 @@ public:
         assert_ready();
     }
 
-    template<class Producer>
-    void produce (const Producer & producer)
+    // open() and publish() split produce() so the producer can fill
+    // an envelope across several calls
+    Message & open ()
     {
-        LOOM_DEBUG_QUEUE("produce " << (position_ % size_plus_one_));
+        LOOM_DEBUG_QUEUE("open " << (position_ % size_plus_one_));
         LOOM_ASSERT2(size_plus_one_ > 1, "cannot use zero-length queue");
 
         const Envelope & fence = envelopes(position_ + 1);
         guards_[stage_count_].acquire(fence.state);
-        Envelope & envelope = envelopes(position_);
-        producer(envelope.message);
-        guards_[0].release(envelope.state);
+        return envelopes(position_).message;
+    }
+
+    void publish ()
+    {
+        LOOM_DEBUG_QUEUE("publish " << (position_ % size_plus_one_));
+        guards_[0].release(envelopes(position_).state);
 
         position_ += 1;
     }
 
+    template<class Producer>
+    void produce (const Producer & producer)
+    {
+        producer(open());
+        publish();
+    }
+
     template<class Consumer>
     void consume (
         size_t stage_number,
@@ -359,23 +473,53 @@ public:
     }
 };
 
+// Each envelope carries a batch of up to batch_size tasks,
+// so that threads synchronize once per batch rather than once per task.
 template<class Task, class ThreadState, size_t cache_line_size = 64>
 class Pipeline
 {
-    struct PipelineTask
+    struct PipelineBatch
     {
-        Task task;
+        std::vector<Task> tasks;
+        size_t size;
         bool exit;
-        PipelineTask () : exit(false) {}
+        PipelineBatch () : tasks(), size(0), exit(false) {}
     };
 
-    PipelineQueue<PipelineTask, cache_line_size> queue_;
+    PipelineQueue<PipelineBatch, cache_line_size> queue_;
+    const size_t batch_size_;
+    PipelineBatch * batch_;
     std::vector<std::thread> threads_;
 
+    PipelineBatch & _open ()
+    {
+        PipelineBatch & batch = queue_.open();
+        if (LOOM_UNLIKELY(batch.tasks.size() != batch_size_)) {
+            std::vector<Task>(batch_size_).swap(batch.tasks);
+        }
+        batch.size = 0;
+        batch.exit = false;
+        return batch;
+    }
+
+    void _flush ()
+    {
+        if (batch_) {
+            batch_ = nullptr;
+            queue_.publish();
+        }
+    }
+
 public:
 
-    Pipeline (size_t capacity, size_t stage_count) :
-        queue_(capacity, stage_count),
+    Pipeline (
+            size_t capacity,
+            size_t stage_count,
+            size_t spin_count = PipelineGuard::default_spin_count,
+            size_t batch_size = 1) :
+        queue_(capacity, stage_count, spin_count),
+        batch_size_(std::max<size_t>(1, batch_size)),
+        batch_(nullptr),
         threads_()
     {
     }
@@ -386,6 +530,23 @@ public:
             const ThreadState & init_thread,
             const Fun & fun)
     {
+        unsafe_add_batch_thread(stage_number, init_thread,
+            [fun](size_t, Task * begin, Task * end, ThreadState & thread){
+            for (Task * task = begin; task != end; ++task) {
+                fun(* task, thread);
+            }
+        });
+    }
+
+    // A batch thread sees each whole batch at once, together with the
+    // batch's queue position, which is the same across all threads.
+    template<class Fun>
+    void unsafe_add_batch_thread (
+            size_t stage_number,
+            const ThreadState & init_thread,
+            const Fun & fun)
+    {
+        LOOM_ASSERT(batch_ == nullptr, "cannot add thread with a batch open");
         queue_.unsafe_add_consumer(stage_number);
         size_t init_position = queue_.unsafe_position();
         threads_.push_back(std::thread(
@@ -393,11 +554,13 @@ public:
             ThreadState thread = init_thread;
             size_t position = init_position;
             for (bool alive = true; LOOM_LIKELY(alive);) {
-                queue_.consume(stage_number, position, [&](PipelineTask & task){
-                    if (LOOM_UNLIKELY(task.exit)) {
+                queue_.consume(stage_number, position,
+                    [&](PipelineBatch & batch){
+                    if (LOOM_UNLIKELY(batch.exit)) {
                         alive = false;
                     } else {
-                        fun(task.task, thread);
+                        Task * begin = batch.tasks.data();
+                        fun(position, begin, begin + batch.size, thread);
                     }
                 });
                 ++position;
@@ -405,6 +568,12 @@ public:
         }));
     }
 
+    size_t unsafe_position ()
+    {
+        LOOM_ASSERT(batch_ == nullptr, "batch is open");
+        return queue_.unsafe_position();
+    }
+
     void validate ()
     {
         queue_.validate();
@@ -413,17 +582,25 @@ public:
     template<class Fun>
     void start (const Fun & fun)
     {
-        queue_.produce([fun](PipelineTask & task){ fun(task.task); });
+        if (batch_ == nullptr) {
+            batch_ = & _open();
+        }
+        fun(batch_->tasks[batch_->size++]);
+        if (batch_->size == batch_size_) {
+            _flush();
+        }
     }
 
     void wait ()
     {
+        _flush();
         queue_.wait();
     }
 
     ~Pipeline ()
     {
-        queue_.produce([](PipelineTask & task) { task.exit = true; });
+        _flush();
+        queue_.produce([](PipelineBatch & batch) { batch.exit = true; });
         queue_.wait();
         for (auto & thread : threads_) {
             thread.join();
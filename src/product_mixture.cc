@@ -26,7 +26,10 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
+#include <cmath>
 #include <loom/product_mixture.hpp>
+#include <loom/score_kernels.hpp>
 #include <distributions/assert_close.hpp>
 
 namespace loom
@@ -129,6 +132,419 @@ inline void ProductMixture_<false>::_remove_tare_cache (size_t groupid)
     }
 }
 
+//----------------------------------------------------------------------------
+// Score columns
+
+template<class T, class Mixture>
+inline void update_score_columns (
+        ScoreColumns<T> &,
+        const typename T::Shared &,
+        const Mixture &,
+        size_t,
+        rng_t &)
+{
+}
+
+// BB columns hold each value's score, as computed by the mixture.
+template<class Mixture>
+inline void update_score_columns (
+        ScoreColumns<BB> & columns,
+        const BB::Shared & shared,
+        const Mixture & mixture,
+        size_t groupid,
+        rng_t & rng)
+{
+    for (bool value : {false, true}) {
+        columns.scores[value][groupid] =
+            mixture.score_value_group(shared, groupid, value, rng);
+    }
+}
+
+// DD scores are log(alphas[value] + counts[value]) - log(their total).
+template<int max_dim, class Mixture>
+inline void update_score_columns (
+        ScoreColumns<DirichletDiscrete<max_dim>> & columns,
+        const typename DirichletDiscrete<max_dim>::Shared & shared,
+        const Mixture & mixture,
+        size_t groupid,
+        rng_t &)
+{
+    const auto & group = mixture.groups(groupid);
+    float total = 0;
+    for (int value = 0; value < shared.dim; ++value) {
+        const float count = shared.alphas[value] + group.counts[value];
+        columns.log_counts[value][groupid] = distributions::fast_log(count);
+        total += count;
+    }
+    columns.log_totals[groupid] = distributions::fast_log(total);
+}
+
+// NICH scores are log densities of each group's posterior predictive,
+// a Student-t with nu degrees of freedom, center mu and scale sigmasq.
+template<class Mixture>
+inline void update_score_columns (
+        ScoreColumns<NICH> & columns,
+        const NICH::Shared & shared,
+        const Mixture & mixture,
+        size_t groupid,
+        rng_t &)
+{
+    const auto & group = mixture.groups(groupid);
+    const float count = group.count;
+    const float kappa = shared.kappa + count;
+    const float nu = shared.nu + count;
+    const float delta = group.mean - shared.mu;
+    const float mu = (shared.kappa * shared.mu + count * group.mean) / kappa;
+    const float posterior_sigmasq = (
+        shared.nu * shared.sigmasq +
+        group.count_times_variance +
+        count * shared.kappa * delta * delta / kappa) / nu;
+    const float sigmasq = posterior_sigmasq * (1 + kappa) / kappa;
+
+    columns.mu[groupid] = mu;
+    columns.scale[groupid] = 1 / (nu * sigmasq);
+    columns.coeff[groupid] =
+        distributions::fast_lgamma(0.5f * (nu + 1)) -
+        distributions::fast_lgamma(0.5f * nu) -
+        0.5f * distributions::fast_log(float(M_PI) * nu * sigmasq);
+    columns.power[groupid] = 0.5f * (nu + 1);
+}
+
+// Adding or removing a value only needs that value's columns updated.
+template<class T, class Mixture>
+inline void update_score_columns (
+        ScoreColumns<T> & columns,
+        const typename T::Shared & shared,
+        const Mixture & mixture,
+        size_t groupid,
+        const typename T::Value &,
+        rng_t & rng)
+{
+    update_score_columns(columns, shared, mixture, groupid, rng);
+}
+
+template<int max_dim, class Mixture>
+inline void update_score_columns (
+        ScoreColumns<DirichletDiscrete<max_dim>> & columns,
+        const typename DirichletDiscrete<max_dim>::Shared & shared,
+        const Mixture & mixture,
+        size_t groupid,
+        const typename DirichletDiscrete<max_dim>::Value & value,
+        rng_t &)
+{
+    const auto & group = mixture.groups(groupid);
+    float total = 0;
+    for (int i = 0; i < shared.dim; ++i) {
+        total += shared.alphas[i] + group.counts[i];
+    }
+    const float count = shared.alphas[value] + group.counts[value];
+    columns.log_counts[value][groupid] = distributions::fast_log(count);
+    columns.log_totals[groupid] = distributions::fast_log(total);
+}
+
+template<class T>
+inline void score_columns_value (
+        const ScoreColumns<T> &,
+        const typename T::Value &,
+        VectorFloat &)
+{
+    LOOM_ERROR("feature type has no score columns");
+}
+
+inline void score_columns_value (
+        const ScoreColumns<BB> & columns,
+        const BB::Value & value,
+        VectorFloat & scores)
+{
+    score_add(scores.size(), scores.data(), columns.scores[value].data());
+}
+
+template<int max_dim>
+inline void score_columns_value (
+        const ScoreColumns<DirichletDiscrete<max_dim>> & columns,
+        const typename DirichletDiscrete<max_dim>::Value & value,
+        VectorFloat & scores)
+{
+    LOOM_ASSERT2(value < columns.log_counts.size(), "bad value: " << value);
+    score_add_shifted(
+        scores.size(),
+        scores.data(),
+        columns.log_counts[value].data(),
+        columns.log_totals.data());
+}
+
+inline void score_columns_value (
+        const ScoreColumns<NICH> & columns,
+        const NICH::Value & value,
+        VectorFloat & scores)
+{
+    score_add_student_t(
+        scores.size(),
+        scores.data(),
+        value,
+        columns.mu.data(),
+        columns.scale.data(),
+        columns.coeff.data(),
+        columns.power.data());
+}
+
+template<bool cached>
+struct ProductMixture_<cached>::init_score_columns_fun
+{
+    const Features & mixtures;
+    const ProductModel::Features & shareds;
+    ScoreColumnsFeatures & columns;
+    const size_t group_count;
+    rng_t & rng;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::template Mixture<cached>::t & mixture)
+    {
+        if (ScoreColumns<T>::used) {
+            const auto & shared = shareds[t][i];
+            auto & feature_columns = columns[t].find(mixtures[t].index(i));
+            feature_columns.init(shared);
+            feature_columns.for_each_column([&](VectorFloat & column){
+                column.resize(group_count);
+            });
+            for (size_t groupid = 0; groupid < group_count; ++groupid) {
+                update_score_columns(
+                    feature_columns,
+                    shared,
+                    mixture,
+                    groupid,
+                    rng);
+            }
+        }
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::add_score_columns_fun
+{
+    const Features & mixtures;
+    ScoreColumnsFeatures & columns;
+    const size_t groupid;
+    rng_t & rng;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Shared & shared)
+    {
+        if (ScoreColumns<T>::used) {
+            auto & feature_columns = columns[t][i];
+            feature_columns.for_each_column([](VectorFloat & column){
+                column.packed_add();
+            });
+            update_score_columns(
+                feature_columns,
+                shared,
+                mixtures[t][i],
+                groupid,
+                rng);
+        }
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::remove_score_columns_fun
+{
+    ScoreColumnsFeatures & columns;
+    const size_t groupid;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        for (auto & feature_columns : columns[t]) {
+            feature_columns.for_each_column([&](VectorFloat & column){
+                column.packed_remove(groupid);
+            });
+        }
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::index_score_columns_fun
+{
+    const Features & mixtures;
+    ScoreColumnsFeatures & columns;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        columns[t].clear();
+        if (ScoreColumns<T>::used) {
+            for (auto featureid : mixtures[t].index()) {
+                columns[t].insert(featureid);
+            }
+        }
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::update_score_columns_fun
+{
+    const Features & mixtures;
+    const ProductModel::Features & shareds;
+    ScoreColumnsFeatures & columns;
+    const size_t groupid;
+    rng_t & rng;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Value & value)
+    {
+        if (ScoreColumns<T>::used) {
+            update_score_columns(
+                columns[t][i],
+                shareds[t][i],
+                mixtures[t][i],
+                groupid,
+                value,
+                rng);
+        }
+    }
+};
+
+// This only fills a feature's existing columns, so features can be filled
+// in parallel; columns are created serially by _init_score_columns and
+// move_feature_to.
+template<>
+void ProductMixture_<true>::init_score_columns (
+        const ProductModel & model,
+        size_t featureid,
+        rng_t & rng)
+{
+    if (not using_score_columns or not maintaining_cache) {
+        return;
+    }
+
+    init_score_columns_fun fun = {
+        features,
+        model.features,
+        score_columns,
+        clustering.counts().size(),
+        rng};
+    for_one_feature(fun, features, featureid);
+}
+
+template<>
+void ProductMixture_<false>::init_score_columns (
+        const ProductModel &,
+        size_t,
+        rng_t &)
+{
+}
+
+template<>
+inline void ProductMixture_<true>::_init_score_columns (
+        const ProductModel & model,
+        rng_t & rng)
+{
+    if (not using_score_columns) {
+        return;
+    }
+
+    index_score_columns_fun index_fun = {features, score_columns};
+    for_each_feature_type(index_fun);
+    if (maintaining_cache) {
+        init_score_columns_fun fun = {
+            features,
+            model.features,
+            score_columns,
+            clustering.counts().size(),
+            rng};
+        for_each_feature(fun, features);
+    }
+}
+
+template<>
+inline void ProductMixture_<false>::_init_score_columns (
+        const ProductModel &,
+        rng_t &)
+{
+}
+
+template<bool cached>
+void ProductMixture_<cached>::init_score_columns (
+        const ProductModel & model,
+        rng_t & rng)
+{
+    _init_score_columns(model, rng);
+}
+
+template<>
+inline void ProductMixture_<true>::_add_score_columns (
+        const ProductModel & model,
+        rng_t & rng)
+{
+    if (using_score_columns and maintaining_cache) {
+        add_score_columns_fun fun = {
+            features,
+            score_columns,
+            clustering.counts().size() - 1,
+            rng};
+        for_each_feature(fun, model.features);
+    }
+}
+
+template<>
+inline void ProductMixture_<false>::_add_score_columns (
+        const ProductModel &,
+        rng_t &)
+{
+}
+
+template<>
+inline void ProductMixture_<true>::_remove_score_columns (size_t groupid)
+{
+    if (using_score_columns and maintaining_cache) {
+        remove_score_columns_fun fun = {score_columns, groupid};
+        for_each_feature_type(fun);
+    }
+}
+
+template<>
+inline void ProductMixture_<false>::_remove_score_columns (size_t)
+{
+}
+
+template<>
+template<class V>
+inline void ProductMixture_<true>::_update_score_columns (
+        const ProductModel & model,
+        size_t groupid,
+        const V & value,
+        rng_t & rng)
+{
+    if (using_score_columns and maintaining_cache) {
+        update_score_columns_fun fun = {
+            features,
+            model.features,
+            score_columns,
+            groupid,
+            rng};
+        read_value(fun, model.schema, features, value);
+    }
+}
+
+template<>
+template<class V>
+inline void ProductMixture_<false>::_update_score_columns (
+        const ProductModel &,
+        size_t,
+        const V &,
+        rng_t &)
+{
+}
+
 template<bool cached>
 struct ProductMixture_<cached>::add_group_fun
 {
@@ -164,10 +580,11 @@ struct ProductMixture_<cached>::add_value_fun
 };
 
 template<bool cached>
-void ProductMixture_<cached>::add_value (
+template<class V>
+inline void ProductMixture_<cached>::_add_value (
         const ProductModel & model,
         size_t groupid,
-        const Value & value,
+        const V & value,
         rng_t & rng)
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
@@ -175,10 +592,12 @@ void ProductMixture_<cached>::add_value (
     bool add_group = clustering.add_value(model.clustering, groupid);
     add_value_fun fun = {features, model.features, groupid, rng};
     read_value(fun, model.schema, features, value);
+    _update_score_columns(model, groupid, value, rng);
 
     if (LOOM_UNLIKELY(add_group)) {
         add_group_fun fun = {features, rng};
         for_each_feature(fun, model.features);
+        _add_score_columns(model, rng);
         id_tracker.add_group();
         validate(model);
     }
@@ -219,10 +638,11 @@ struct ProductMixture_<cached>::remove_value_fun
 };
 
 template<bool cached>
-void ProductMixture_<cached>::remove_value (
+template<class V>
+inline void ProductMixture_<cached>::_remove_value (
         const ProductModel & model,
         size_t groupid,
-        const Value & value,
+        const V & value,
         rng_t & rng)
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
@@ -234,11 +654,68 @@ void ProductMixture_<cached>::remove_value (
     if (LOOM_UNLIKELY(remove_group)) {
         remove_group_fun fun = {features, groupid};
         for_each_feature(fun, model.features);
+        _remove_score_columns(groupid);
         id_tracker.remove_group(groupid);
         validate(model);
+    } else {
+        _update_score_columns(model, groupid, value, rng);
     }
 }
 
+template<bool cached>
+void ProductMixture_<cached>::add_value (
+        const ProductModel & model,
+        size_t groupid,
+        const Value & value,
+        rng_t & rng)
+{
+    _add_value(model, groupid, value, rng);
+}
+
+template<bool cached>
+void ProductMixture_<cached>::add_value (
+        const ProductModel & model,
+        size_t groupid,
+        const FlatValue & value,
+        rng_t & rng)
+{
+    _add_value(model, groupid, value, rng);
+}
+
+template<bool cached>
+void ProductMixture_<cached>::remove_value (
+        const ProductModel & model,
+        size_t groupid,
+        const Value & value,
+        rng_t & rng)
+{
+    _remove_value(model, groupid, value, rng);
+}
+
+template<bool cached>
+void ProductMixture_<cached>::remove_value (
+        const ProductModel & model,
+        size_t groupid,
+        const FlatValue & value,
+        rng_t & rng)
+{
+    _remove_value(model, groupid, value, rng);
+}
+
+template<bool cached>
+inline void ProductMixture_<cached>::_update_score_columns (
+        const ProductModel & model,
+        size_t groupid,
+        const Value::Diff & diff,
+        rng_t & rng)
+{
+    for (auto id : diff.tares()) {
+        _update_score_columns(model, groupid, model.tares[id], rng);
+    }
+    _update_score_columns(model, groupid, diff.pos(), rng);
+    _update_score_columns(model, groupid, diff.neg(), rng);
+}
+
 template<bool cached>
 void ProductMixture_<cached>::add_diff (
         const ProductModel & model,
@@ -262,11 +739,13 @@ void ProductMixture_<cached>::add_diff (
         read_value(fun, model.schema, features, diff.neg());
     }
     _update_tare_cache(model, groupid, rng);
+    _update_score_columns(model, groupid, diff, rng);
 
     if (LOOM_UNLIKELY(add_group)) {
         add_group_fun fun = {features, rng};
         for_each_feature(fun, model.features);
         _add_tare_cache(model, rng);
+        _add_score_columns(model, rng);
         id_tracker.add_group();
         validate(model);
     }
@@ -299,10 +778,12 @@ void ProductMixture_<cached>::remove_diff (
         remove_group_fun fun = {features, groupid};
         for_each_feature(fun, model.features);
         _remove_tare_cache(groupid);
+        _remove_score_columns(groupid);
         id_tracker.remove_group(groupid);
         validate(model);
     } else {
         _update_tare_cache(model, groupid, rng);
+        _update_score_columns(model, groupid, diff, rng);
     }
 }
 
@@ -408,6 +889,7 @@ struct ProductMixture_<cached>::score_value_fun
     const ProductModel::Features & shareds;
     VectorFloat & scores;
     rng_t & rng;
+    const ScoreColumnsFeatures * columns;
 
     template<class T>
     void operator() (
@@ -415,14 +897,19 @@ struct ProductMixture_<cached>::score_value_fun
             size_t i,
             const typename T::Value & value)
     {
-        mixtures[t][i].score_value(shareds[t][i], value, scores, rng);
+        if (ScoreColumns<T>::used and columns) {
+            score_columns_value((*columns)[t][i], value, scores);
+        } else {
+            mixtures[t][i].score_value(shareds[t][i], value, scores, rng);
+        }
     }
 };
 
 template<>
-void ProductMixture_<true>::score_value (
+template<class V>
+inline void ProductMixture_<true>::_score_value (
         const ProductModel & model,
-        const Value & value,
+        const V & value,
         VectorFloat & scores,
         rng_t & rng) const
 {
@@ -430,10 +917,35 @@ void ProductMixture_<true>::score_value (
 
     scores.resize(clustering.counts().size());
     clustering.score_value(model.clustering, scores);
-    score_value_fun fun = {features, model.features, scores, rng};
+    score_value_fun fun = {
+        features,
+        model.features,
+        scores,
+        rng,
+        _score_columns()};
     read_value(fun, model.schema, features, value);
 }
 
+template<>
+void ProductMixture_<true>::score_value (
+        const ProductModel & model,
+        const Value & value,
+        VectorFloat & scores,
+        rng_t & rng) const
+{
+    _score_value(model, value, scores, rng);
+}
+
+template<>
+void ProductMixture_<true>::score_value (
+        const ProductModel & model,
+        const FlatValue & value,
+        VectorFloat & scores,
+        rng_t & rng) const
+{
+    _score_value(model, value, scores, rng);
+}
+
 template<>
 void ProductMixture_<true>::score_diff (
         const ProductModel & model,
@@ -446,7 +958,12 @@ void ProductMixture_<true>::score_diff (
     const size_t size = clustering.counts().size();
     scores.resize(size);
     clustering.score_value(model.clustering, scores);
-    score_value_fun fun = {features, model.features, scores, rng};
+    score_value_fun fun = {
+        features,
+        model.features,
+        scores,
+        rng,
+        _score_columns()};
     read_value(fun, model.schema, features, diff.pos());
     if (model.schema.total_size(diff.neg())) {
         distributions::vector_negate(size, scores.data());
@@ -470,6 +987,7 @@ struct ProductMixture_<cached>::score_value_features_fun
     const ProductModel::Features & shareds;
     VectorFloat ** scores;
     rng_t & rng;
+    const ScoreColumnsFeatures * columns;
 
     template<class T>
     void operator() (
@@ -477,7 +995,16 @@ struct ProductMixture_<cached>::score_value_features_fun
             size_t i,
             const typename T::Value & value)
     {
-        mixtures[t][i].score_value(shareds[t][i], value, **scores++, rng);
+        VectorFloat & feature_scores = **scores++;
+        if (ScoreColumns<T>::used and columns) {
+            score_columns_value((*columns)[t][i], value, feature_scores);
+        } else {
+            mixtures[t][i].score_value(
+                shareds[t][i],
+                value,
+                feature_scores,
+                rng);
+        }
     }
 };
 
@@ -504,10 +1031,124 @@ void ProductMixture_<true>::score_value_features (
         features,
         model.features,
         feature_scores.data(),
-        rng};
+        rng,
+        _score_columns()};
     read_value(fun, model.schema, features, value);
 }
 
+// Values of a batch are transposed to per-feature lists of (row, value),
+// so that scoring can proceed feature by feature.
+template<bool cached>
+struct ProductMixture_<cached>::BatchedValues
+{
+    template<class T>
+    struct Container
+    {
+        typedef std::vector<std::vector<std::pair<size_t, typename T::Value>>>
+            t;
+    };
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::batch_values_fun
+{
+    const Features & mixtures;
+    ForEachFeatureType<BatchedValues> & batches;
+    size_t row;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        batches[t].resize(mixtures[t].size());
+    }
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Value & value)
+    {
+        batches[t][i].push_back(std::make_pair(row, value));
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::score_values_fun
+{
+    const Features & mixtures;
+    const ProductModel::Features & shareds;
+    const ForEachFeatureType<BatchedValues> & batches;
+    std::vector<VectorFloat> & scores;
+    rng_t & rng;
+    const ScoreColumnsFeatures * columns;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        const auto & batch = batches[t];
+        for (size_t i = 0, size = batch.size(); i < size; ++i) {
+            if (ScoreColumns<T>::used and columns) {
+                const auto & feature_columns = (*columns)[t][i];
+                for (const auto & pair : batch[i]) {
+                    score_columns_value(
+                        feature_columns,
+                        pair.second,
+                        scores[pair.first]);
+                }
+            } else {
+                const auto & mixture = mixtures[t][i];
+                const auto & shared = shareds[t][i];
+                for (const auto & pair : batch[i]) {
+                    mixture.score_value(
+                        shared,
+                        pair.second,
+                        scores[pair.first],
+                        rng);
+                }
+            }
+        }
+    }
+};
+
+template<>
+void ProductMixture_<true>::score_values (
+        const ProductModel & model,
+        const std::vector<const Value *> & values,
+        std::vector<VectorFloat> & scores,
+        rng_t & rng) const
+{
+    LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
+
+    const size_t row_count = values.size();
+    scores.resize(row_count);
+    if (row_count == 0) {
+        return;
+    }
+
+    scores[0].resize(clustering.counts().size());
+    clustering.score_value(model.clustering, scores[0]);
+    for (size_t row = 1; row < row_count; ++row) {
+        scores[row] = scores[0];
+    }
+
+    ForEachFeatureType<BatchedValues> batches;
+    batch_values_fun batch_fun = {features, batches, 0};
+    for_each_feature_type(batch_fun);
+    for (size_t row = 0; row < row_count; ++row) {
+        batch_fun.row = row;
+        read_value(batch_fun, model.schema, features, * values[row]);
+    }
+
+    score_values_fun score_fun = {
+        features,
+        model.features,
+        batches,
+        scores,
+        rng,
+        _score_columns()};
+    for_each_feature_type(score_fun);
+}
+
 template<bool cached>
 struct ProductMixture_<cached>::init_feature_cache_fun
 {
@@ -533,6 +1174,7 @@ void ProductMixture_<cached>::init_feature_cache (
     if (maintaining_cache) {
         init_feature_cache_fun fun = {model.features, rng};
         for_one_feature(fun, features, featureid);
+        init_score_columns(model, featureid, rng);
     }
 }
 
@@ -550,7 +1192,12 @@ void ProductMixture_<cached>::init_tare_cache (
                 auto & scores = tare_caches[i].scores;
                 scores.resize(group_count);
                 distributions::vector_zero(scores.size(), scores.data());
-                score_value_fun fun = {features, model.features, scores, rng};
+                score_value_fun fun = {
+                    features,
+                    model.features,
+                    scores,
+                    rng,
+                    _score_columns()};
                 read_value(fun, model.schema, features, tare);
             }
         } else {
@@ -695,6 +1342,7 @@ void ProductMixture_<cached>::init_unobserved (
         rng};
     for_each_feature_type(fun);
 
+    _init_score_columns(model, rng);
     init_tare_cache(model, rng);
     id_tracker.init(counts.size());
 
@@ -742,6 +1390,26 @@ void ProductMixture_<cached>::load_step_1_of_3 (
         const ProductModel & model,
         const char * filename,
         size_t empty_group_count)
+{
+    protobuf::InFile groups(filename);
+    _load_groups(model, groups, empty_group_count);
+}
+
+template<bool cached>
+void ProductMixture_<cached>::load_step_1_of_3 (
+        const ProductModel & model,
+        protobuf::InBuffer & groups,
+        size_t empty_group_count)
+{
+    _load_groups(model, groups, empty_group_count);
+}
+
+template<bool cached>
+template<class Stream>
+void ProductMixture_<cached>::_load_groups (
+        const ProductModel & model,
+        Stream & groups,
+        size_t empty_group_count)
 {
     clear_fun fun = {model.features, features};
     for_each_feature_type(fun);
@@ -751,8 +1419,8 @@ void ProductMixture_<cached>::load_step_1_of_3 (
         tare_cache.scores.clear();
         tare_cache.counts.clear();
     }
+    score_columns = ScoreColumnsFeatures();
 
-    protobuf::InFile groups(filename);
     protobuf::ProductModel::Group message;
     while (groups.try_read_stream(message)) {
         counts.push_back(message.count());
@@ -865,6 +1533,8 @@ struct ProductMixture_<cached>::move_feature_to_fun
     typename OtherMixture::Features & source_mixtures;
     ProductModel::Features & destin_shareds;
     typename OtherMixture::Features & destin_mixtures;
+    typename OtherMixture::ScoreColumnsFeatures & source_columns;
+    typename OtherMixture::ScoreColumnsFeatures & destin_columns;
 
     template<class T>
     void operator() (
@@ -881,6 +1551,11 @@ struct ProductMixture_<cached>::move_feature_to_fun
         source_mixtures[t].remove(featureid);
         auto & destin_mixture = destin_mixtures[t].insert(featureid);
         destin_mixture.groups() = std::move(temp_mixture.groups());
+
+        if (source_columns[t].try_find_pos(featureid)) {
+            source_columns[t].remove(featureid);
+            destin_columns[t].insert(featureid);
+        }
     }
 };
 
@@ -908,7 +1583,8 @@ void ProductMixture_<cached>::move_feature_to (
     move_feature_to_fun<OtherMixture> fun = {
         featureid,
         source_model.features, source_mixture.features,
-        destin_model.features, destin_mixture.features};
+        destin_model.features, destin_mixture.features,
+        source_mixture.score_columns, destin_mixture.score_columns};
     for_one_feature(fun, features, featureid);
 
     source_model.schema.load(source_model.features);
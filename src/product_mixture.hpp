@@ -30,9 +30,123 @@
 
 #include <loom/product_model.hpp>
 
+// Build with -DLOOM_SCORE_COLUMNS=1 to score BB, DD and NICH features from
+// score columns maintained by FastProductMixture, rather than through their
+// distributions mixtures; see ScoreColumns below.
+#ifndef LOOM_SCORE_COLUMNS
+#  define LOOM_SCORE_COLUMNS 0
+#endif // LOOM_SCORE_COLUMNS
+
 namespace loom
 {
 
+// Score columns are contiguous per-group arrays from which the loops in
+// score_kernels.hpp score one value of a feature against all groups.
+// BB keeps each value's score; DD keeps each value's log pseudocount and
+// the log total; NICH keeps each group's posterior predictive Student-t
+// parameters. DPD and GP have no columns and are scored by their mixtures.
+template<class T>
+struct ScoreColumns
+{
+    enum { used = false };
+
+    template<class Shared>
+    void init (const Shared &) {}
+
+    template<class Fun>
+    void for_each_column (Fun) {}
+
+    template<class Fun>
+    void for_each_column (Fun) const {}
+};
+
+template<>
+struct ScoreColumns<BB>
+{
+    enum { used = true };
+
+    VectorFloat scores[2];
+
+    void init (const BB::Shared &) {}
+
+    template<class Fun>
+    void for_each_column (Fun fun)
+    {
+        fun(scores[0]);
+        fun(scores[1]);
+    }
+
+    template<class Fun>
+    void for_each_column (Fun fun) const
+    {
+        fun(scores[0]);
+        fun(scores[1]);
+    }
+};
+
+template<int max_dim>
+struct ScoreColumns<DirichletDiscrete<max_dim>>
+{
+    enum { used = true };
+
+    std::vector<VectorFloat> log_counts;
+    VectorFloat log_totals;
+
+    void init (const typename DirichletDiscrete<max_dim>::Shared & shared)
+    {
+        log_counts.resize(shared.dim);
+    }
+
+    template<class Fun>
+    void for_each_column (Fun fun)
+    {
+        for (auto & column : log_counts) {
+            fun(column);
+        }
+        fun(log_totals);
+    }
+
+    template<class Fun>
+    void for_each_column (Fun fun) const
+    {
+        for (const auto & column : log_counts) {
+            fun(column);
+        }
+        fun(log_totals);
+    }
+};
+
+template<>
+struct ScoreColumns<NICH>
+{
+    enum { used = true };
+
+    VectorFloat mu;
+    VectorFloat scale;
+    VectorFloat coeff;
+    VectorFloat power;
+
+    void init (const NICH::Shared &) {}
+
+    template<class Fun>
+    void for_each_column (Fun fun)
+    {
+        fun(mu);
+        fun(scale);
+        fun(coeff);
+        fun(power);
+    }
+
+    template<class Fun>
+    void for_each_column (Fun fun) const
+    {
+        fun(mu);
+        fun(scale);
+        fun(coeff);
+        fun(power);
+    }
+};
+
 template<bool cached> struct ProductMixture_;
 typedef ProductMixture_<false> SmallProductMixture;
 typedef ProductMixture_<true> FastProductMixture;
@@ -57,9 +171,24 @@ struct ProductMixture_
         distributions::Packed_<uint32_t> counts;
     };
 
+    // Indexed like features: for each type with columns, both hold the
+    // same featureids, so positions agree.
+    struct ScoreColumnsFeature
+    {
+        template<class T>
+        struct Container
+        {
+            typedef IndexedVector<ScoreColumns<T>> t;
+        };
+    };
+    typedef ForEachFeatureType<ScoreColumnsFeature> ScoreColumnsFeatures;
+
+    static const bool using_score_columns = cached and LOOM_SCORE_COLUMNS;
+
     typename Clustering::Mixture<cached>::t clustering;
     Features features;
     std::vector<TareCache> tare_caches;
+    ScoreColumnsFeatures score_columns;
     distributions::MixtureIdTracker id_tracker;
     bool maintaining_cache;
 
@@ -72,6 +201,10 @@ struct ProductMixture_
             const ProductModel & model,
             const char * filename,
             size_t empty_group_count);
+    void load_step_1_of_3 (
+            const ProductModel & model,
+            protobuf::InBuffer & groups,
+            size_t empty_group_count);
 
     void load_step_2_of_3 (
             const ProductModel & model,
@@ -99,6 +232,18 @@ struct ProductMixture_
             const Value & value,
             rng_t & rng);
 
+    void add_value (
+            const ProductModel & model,
+            size_t groupid,
+            const FlatValue & value,
+            rng_t & rng);
+
+    void remove_value (
+            const ProductModel & model,
+            size_t groupid,
+            const FlatValue & value,
+            rng_t & rng);
+
     void add_diff (
             const ProductModel & model,
             size_t groupid,
@@ -131,6 +276,12 @@ struct ProductMixture_
             VectorFloat & scores,
             rng_t & rng) const;
 
+    void score_value (
+            const ProductModel & model,
+            const FlatValue & value,
+            VectorFloat & scores,
+            rng_t & rng) const;
+
     void score_diff (
             const ProductModel & model,
             const Value::Diff & diff,
@@ -143,6 +294,15 @@ struct ProductMixture_
             std::vector<VectorFloat *> & scores,
             rng_t & rng) const;
 
+    // Scores a batch of values against all groups, one row per value.
+    // Clustering scores are computed once per batch; then each feature
+    // scores all rows of the batch before moving to the next feature.
+    void score_values (
+            const ProductModel & model,
+            const std::vector<const Value *> & values,
+            std::vector<VectorFloat> & scores,
+            rng_t & rng) const;
+
     float score_feature (
             const ProductModel & model,
             size_t featureid,
@@ -176,6 +336,14 @@ struct ProductMixture_
             const ProductModel & model,
             rng_t & rng);
 
+    void init_score_columns (
+            const ProductModel & model,
+            size_t featureid,
+            rng_t & rng);
+
+    // creates and fills every feature's columns, e.g. after loading groups
+    void init_score_columns (const ProductModel & model, rng_t & rng);
+
     void validate (const ProductModel & model) const;
 
     size_t count_rows () const
@@ -186,6 +354,27 @@ struct ProductMixture_
 
 private:
 
+    template<class V>
+    void _add_value (
+            const ProductModel & model,
+            size_t groupid,
+            const V & value,
+            rng_t & rng);
+
+    template<class V>
+    void _remove_value (
+            const ProductModel & model,
+            size_t groupid,
+            const V & value,
+            rng_t & rng);
+
+    template<class V>
+    void _score_value (
+            const ProductModel & model,
+            const V & value,
+            VectorFloat & scores,
+            rng_t & rng) const;
+
     void _add_tare_cache (const ProductModel & model, rng_t & rng);
     void _remove_tare_cache (size_t groupid);
     void _update_tare_cache (
@@ -193,6 +382,38 @@ private:
             size_t groupid,
             rng_t & rng);
 
+    void _init_score_columns (const ProductModel & model, rng_t & rng);
+    void _add_score_columns (const ProductModel & model, rng_t & rng);
+    void _remove_score_columns (size_t groupid);
+    template<class V>
+    void _update_score_columns (
+            const ProductModel & model,
+            size_t groupid,
+            const V & value,
+            rng_t & rng);
+    void _update_score_columns (
+            const ProductModel & model,
+            size_t groupid,
+            const Value::Diff & diff,
+            rng_t & rng);
+
+    const ScoreColumnsFeatures * _score_columns () const
+    {
+        if (using_score_columns and maintaining_cache) {
+            check_score_columns_fun fun = {features, score_columns};
+            for_each_feature_type(fun);
+            return & score_columns;
+        } else {
+            return nullptr;
+        }
+    }
+
+    template<class Stream>
+    void _load_groups (
+            const ProductModel & model,
+            Stream & groups,
+            size_t empty_group_count);
+
     struct validate_fun;
     struct clear_fun;
     struct load_group_fun;
@@ -208,7 +429,17 @@ private:
     struct add_diff_fun;
     struct score_value_fun;
     struct score_value_features_fun;
+    struct BatchedValues;
+    struct batch_values_fun;
+    struct score_values_fun;
     struct score_value_group_fun;
+    struct check_score_columns_fun;
+    struct validate_score_columns_fun;
+    struct init_score_columns_fun;
+    struct add_score_columns_fun;
+    struct remove_score_columns_fun;
+    struct index_score_columns_fun;
+    struct update_score_columns_fun;
     struct score_feature_fun;
     struct score_data_fun;
     struct sample_fun;
@@ -247,6 +478,42 @@ struct ProductMixture_<cached>::validate_fun
     }
 };
 
+// Scoring indexes columns by position, so they must match features.
+template<bool cached>
+struct ProductMixture_<cached>::check_score_columns_fun
+{
+    const Features & mixtures;
+    const ScoreColumnsFeatures & columns;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        if (ScoreColumns<T>::used) {
+            LOOM_ASSERT_EQ(columns[t].size(), mixtures[t].size());
+            if (LOOM_DEBUG_LEVEL >= 1) {
+                LOOM_ASSERT_EQ(columns[t].index(), mixtures[t].index());
+            }
+        }
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::validate_score_columns_fun
+{
+    const size_t group_count;
+    const ScoreColumnsFeatures & columns;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        for (const auto & feature_columns : columns[t]) {
+            feature_columns.for_each_column([&](const VectorFloat & column){
+                LOOM_ASSERT_EQ(column.size(), group_count);
+            });
+        }
+    }
+};
+
 template<bool cached>
 inline void ProductMixture_<cached>::validate (
         const ProductModel & model) const
@@ -273,6 +540,13 @@ inline void ProductMixture_<cached>::validate (
                     LOOM_ASSERT_EQ(tare_cache.counts.size(), group_count);
                 }
             }
+            if (using_score_columns) {
+                _score_columns();
+                validate_score_columns_fun fun = {
+                    group_count,
+                    score_columns};
+                for_each_feature_type(fun);
+            }
         }
         LOOM_ASSERT_EQ(id_tracker.packed_size(), group_count);
     }
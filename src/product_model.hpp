@@ -65,6 +65,8 @@ struct ProductModel
 
     void add_value (const Value & value, rng_t & rng);
     void remove_value (const Value & value, rng_t & rng);
+    void add_value (const FlatValue & value, rng_t & rng);
+    void remove_value (const FlatValue & value, rng_t & rng);
     void add_diff (const Value::Diff & diff, rng_t & rng);
     void remove_diff (const Value::Diff & diff, rng_t & rng);
     void realize (rng_t & rng);
@@ -137,6 +139,22 @@ inline void ProductModel::remove_value (
     read_value(fun, schema, features, value);
 }
 
+inline void ProductModel::add_value (
+        const FlatValue & value,
+        rng_t & rng)
+{
+    add_value_fun fun = {features, rng};
+    read_value(fun, schema, features, value);
+}
+
+inline void ProductModel::remove_value (
+        const FlatValue & value,
+        rng_t & rng)
+{
+    remove_value_fun fun = {features, rng};
+    read_value(fun, schema, features, value);
+}
+
 inline void ProductModel::add_diff (
         const Value::Diff & diff,
         rng_t & rng)
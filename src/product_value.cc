@@ -119,25 +119,42 @@ void ValueSplitter::init (
     for (auto & p : part_to_full_) {
         p.clear();
     }
+    for (auto * plan : {
+            & gather_plan_.booleans,
+            & gather_plan_.counts,
+            & gather_plan_.reals})
+    {
+        plan->resize(part_count);
+        for (auto & p : * plan) {
+            p.clear();
+        }
+    }
 
     size_t full_pos = 0;
+    size_t begin;
     size_t end;
+    begin = full_pos;
     for (end = full_pos + schema.booleans_size; full_pos < end; ++full_pos) {
         auto partid = full_to_partid_[full_pos];
         full_to_part_[full_pos] = part_schemas_[partid].total_size();
         part_to_full_[partid].push_back(full_pos);
+        gather_plan_.booleans[partid].push_back(full_pos - begin);
         part_schemas_[partid].booleans_size += 1;
     }
+    begin = full_pos;
     for (end = full_pos + schema.counts_size; full_pos < end; ++full_pos) {
         auto partid = full_to_partid_[full_pos];
         full_to_part_[full_pos] = part_schemas_[partid].total_size();
         part_to_full_[partid].push_back(full_pos);
+        gather_plan_.counts[partid].push_back(full_pos - begin);
         part_schemas_[partid].counts_size += 1;
     }
+    begin = full_pos;
     for (end = full_pos + schema.reals_size; full_pos < end; ++full_pos) {
         auto partid = full_to_partid_[full_pos];
         full_to_part_[full_pos] = part_schemas_[partid].total_size();
         part_to_full_[partid].push_back(full_pos);
+        gather_plan_.reals[partid].push_back(full_pos - begin);
         part_schemas_[partid].reals_size += 1;
     }
     LOOM_ASSERT_EQ(full_pos, feature_count);
@@ -145,23 +162,28 @@ void ValueSplitter::init (
 
 struct ValueSplitter::split_value_all_fun
 {
-    const std::vector<uint32_t> & full_to_partid_;
+    const ForEachDataType<Plan> & gather_plan;
     const ProductValue & full_value;
     std::vector<ProductValue *> & partial_values;
-    size_t full_pos;
 
     template<class FieldType>
-    void operator() (FieldType *, size_t size)
+    void operator() (FieldType * t, size_t size)
     {
         typedef protobuf::Fields<FieldType> Fields;
-        auto full_fields = Fields::get(full_value).begin();
-        for (size_t end = full_pos + size; full_pos < end; ++full_pos) {
-            auto & partial_value = * partial_values[full_to_partid_[full_pos]];
-            Fields::get(partial_value).Add(*full_fields++);
+        const auto & full_fields = Fields::get(full_value);
+        LOOM_ASSERT1(full_fields.size() == size, "programmer error");
+        const FieldType * source = full_fields.data();
+        const auto & plan = gather_plan[t];
+        for (size_t partid = 0; partid < plan.size(); ++partid) {
+            const uint32_t * gather = plan[partid].data();
+            const size_t part_size = plan[partid].size();
+            auto & partial_fields = Fields::get(* partial_values[partid]);
+            partial_fields.Resize(part_size, FieldType());
+            FieldType * destin = partial_fields.mutable_data();
+            for (size_t i = 0; i < part_size; ++i) {
+                destin[i] = source[gather[i]];
+            }
         }
-        LOOM_ASSERT1(
-            full_fields == Fields::get(full_value).end(),
-            "programmer error");
     }
 };
 
@@ -238,14 +260,10 @@ void ValueSplitter::split (
         switch (sparsity) {
             case ProductValue::Observed::ALL: {
                 split_value_all_fun fun = {
-                    full_to_partid_,
+                    gather_plan_,
                     full_value,
-                    partial_values,
-                    0};
+                    partial_values};
                 schema_.for_each_datatype(fun);
-                LOOM_ASSERT1(
-                    fun.full_pos == full_to_partid_.size(),
-                    "programmer error");
             } break;
 
             case ProductValue::Observed::DENSE: {
@@ -767,6 +767,124 @@ inline void read_value (
     }
 }
 
+//----------------------------------------------------------------------------
+// Flat Value
+//
+// A ProductValue decoded into one list of (feature position, value) pairs
+// per feature type.  Decoding pays for protobuf access and sparsity
+// dispatch once, so that a value read several times, e.g. by a model add,
+// a mixture score and a mixture add, is thereafter read by plain loops.
+
+struct FlatValue
+{
+    struct Fields
+    {
+        template<class T>
+        struct Container
+        {
+            typedef std::vector<std::pair<uint32_t, typename T::Value>> t;
+        };
+    };
+
+    ForEachFeatureType<Fields> fields;
+
+    template<class Feature>
+    void load (
+            const ValueSchema & value_schema,
+            const ForEachFeatureType<Feature> & model_schema,
+            const ProductValue & value);
+
+private:
+
+    struct clear_fun;
+    struct load_fun;
+};
+
+struct FlatValue::clear_fun
+{
+    ForEachFeatureType<Fields> & fields;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        fields[t].clear();
+    }
+};
+
+struct FlatValue::load_fun
+{
+    ForEachFeatureType<Fields> & fields;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Value & value)
+    {
+        fields[t].push_back(std::make_pair(i, value));
+    }
+};
+
+template<class Feature>
+inline void FlatValue::load (
+        const ValueSchema & value_schema,
+        const ForEachFeatureType<Feature> & model_schema,
+        const ProductValue & value)
+{
+    clear_fun clear = {fields};
+    for_each_feature_type(clear);
+    load_fun fun = {fields};
+    read_value(fun, value_schema, model_schema, value);
+}
+
+// Loads value into this thread's FlatValue, which stays valid until the
+// thread's next call.
+template<class Feature>
+inline FlatValue & thread_local_flat_value (
+        const ValueSchema & value_schema,
+        const ForEachFeatureType<Feature> & model_schema,
+        const ProductValue & value)
+{
+    // not freed
+    static thread_local FlatValue * flat_value = nullptr;
+    construct_if_null(flat_value);
+
+    flat_value->load(value_schema, model_schema, value);
+    return * flat_value;
+}
+
+template<class Feature, class Fun>
+inline void read_value (
+        Fun & fun,
+        const ValueSchema & value_schema,
+        const ForEachFeatureType<Feature> & model_schema,
+        const FlatValue & value)
+{
+    if (LOOM_DEBUG_LEVEL >= 2) {
+        value_schema.validate(model_schema);
+    }
+
+    const auto & fields = value.fields;
+    for (const auto & pair : fields.bb) {
+        fun(BB::null(), pair.first, pair.second);
+    }
+    for (const auto & pair : fields.dd16) {
+        fun(DD16::null(), pair.first, pair.second);
+    }
+    for (const auto & pair : fields.dd256) {
+        fun(DD256::null(), pair.first, pair.second);
+    }
+    for (const auto & pair : fields.dpd) {
+        fun(DPD::null(), pair.first, pair.second);
+    }
+    for (const auto & pair : fields.gp) {
+        fun(GP::null(), pair.first, pair.second);
+    }
+    for (const auto & pair : fields.nich) {
+        fun(NICH::null(), pair.first, pair.second);
+    }
+}
+
 //----------------------------------------------------------------------------
 // Write
 
@@ -984,11 +1102,24 @@ private:
     };
     typedef ForEachDataType<Map> Maps;
 
+    // Per datatype and part, the full value's packed field positions that
+    // make up the part's packed field, compiled by init() so that a fully
+    // observed value splits by gathering.
+    struct Plan
+    {
+        template<class T>
+        struct Container
+        {
+            typedef std::vector<std::vector<uint32_t>> t;
+        };
+    };
+
     ValueSchema schema_;
     std::vector<ValueSchema> part_schemas_;
     std::vector<uint32_t> full_to_partid_;
     std::vector<uint32_t> full_to_part_;
     std::vector<std::vector<uint32_t>> part_to_full_;
+    ForEachDataType<Plan> gather_plan_;
 
     void unsafe_join (
             ProductValue & full_value,
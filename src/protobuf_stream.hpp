@@ -30,34 +30,103 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <vector>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/io/gzip_stream.h>
 #include <loom/common.hpp>
+#include <loom/block_gzip_stream.hpp>
+#include <loom/codec_stream.hpp>
+#include <loom/row_chunks.hpp>
+#include <loom/schema.pb.h>
 
 namespace loom
 {
 namespace protobuf
 {
 
-inline bool endswith (const char * filename, const char * suffix)
+inline bool is_compressed (const char * filename)
 {
-    return strlen(filename) >= strlen(suffix) and
-        strcmp(filename + strlen(filename) - strlen(suffix), suffix) == 0;
+    return endswith(filename, ".gz") or has_codec_suffix(filename);
 }
 
+inline bool is_std_stream (const std::string & filename)
+{
+    return filename == "-" or (
+        filename.size() > 2 and filename[0] == '-' and filename[1] == '.' and
+        is_compressed(filename.c_str()));
+}
+
+typedef ::protobuf::loom::StreamIndex StreamIndex;
+
+inline std::string get_index_path (const std::string & filename)
+{
+    return filename + ".index";
+}
+
+// A serialized message that is either borrowed from a memory-mapped file
+// or copied into a private buffer. Borrowed data remains valid as long as
+// the InFile it was read from.
+class RawMessage
+{
+public:
+
+    RawMessage () : data_(nullptr), size_(0) {}
+
+    const char * data () const { return data_; }
+    size_t size () const { return size_; }
+
+    void borrow (const char * data, size_t size)
+    {
+        data_ = data;
+        size_ = size;
+    }
+
+    char * copy (size_t size)
+    {
+        buffer_.resize(size);
+        data_ = buffer_.data();
+        size_ = size;
+        return buffer_.data();
+    }
+
+    void swap (RawMessage & other)
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        buffer_.swap(other.buffer_);
+    }
+
+private:
+
+    const char * data_;
+    size_t size_;
+    std::vector<char> buffer_;
+};
+
 class InFile : noncopyable
 {
 public:
 
-    InFile (int fid) : fid_(fid)
+    // MMAP is a hint: only uncompressed regular files are mapped
+    enum { MMAP = 1 };
+
+    InFile (int fid) :
+        fid_(fid),
+        flags_(0),
+        index_state_(INDEX_MISSING),
+        chunks_(nullptr)
     {
         _open();
     }
 
-    InFile (const char * filename) : filename_(filename)
+    InFile (const char * filename, int flags = 0) :
+        filename_(filename),
+        flags_(flags),
+        index_state_(INDEX_UNKNOWN),
+        chunks_(is_row_chunks(filename) ? new RowChunkDecoder() : nullptr)
     {
         LOOM_ASSERT(not filename_.empty(), "empty filename is not supported");
         _open();
@@ -66,18 +135,46 @@ public:
     ~InFile ()
     {
         _close();
+        delete chunks_;
     }
 
     const char * filename () const { return filename_.c_str(); }
     bool is_file () const { return is_file_; }
+    bool is_mapped () const { return mapped_ != nullptr; }
 
     uint64_t position () const { return position_; }
 
+    // whether set_position can jump via an index rather than scan
+    bool is_seekable () { return _load_index() and _is_seekable(); }
+
     void set_position (uint64_t target)
     {
+        if (chunks_) {
+            _set_chunked_position(target);
+            return;
+        }
+
+        if (target != position_ and _load_index() and _is_seekable()) {
+            const uint64_t block = target / index_.block_size();
+            const uint64_t block_position = block * index_.block_size();
+            if (block < index_.offsets_size() and
+                (target < position_ or position_ < block_position))
+            {
+                _seek(block);
+            }
+        }
+
         if (target < position_) {
-            _close();
-            _open();
+            _rewind();
+        }
+
+        if (is_mapped()) {
+            const char * data;
+            uint32_t message_size;
+            while (position_ < target) {
+                bool success = _try_read_mapped(data, message_size);
+                LOOM_ASSERT(success, "failed to set position of " << filename_);
+            }
         }
 
         while (position_ < target) {
@@ -98,38 +195,45 @@ public:
         LOOM_ASSERT(success, "failed to parse message from " << filename_);
     }
 
+    // Row chunk files are read as if they were streams of rows,
+    // each decoded directly into the caller's Row.
     template<class Message>
     bool try_read_stream (Message & message)
     {
-        google::protobuf::io::CodedInputStream coded(stream_);
-        uint32_t message_size = 0;
-        if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
-            auto old_limit = coded.PushLimit(message_size);
-            bool success = message.ParseFromCodedStream(& coded);
-            LOOM_ASSERT(success, "failed to parse message from " << filename_);
-            coded.PopLimit(old_limit);
-            ++position_;
-            return true;
-        } else {
-            return false;
+        if (LOOM_UNLIKELY(chunks_ != nullptr)) {
+            return _try_read_chunked(message);
         }
+        return _try_read_message(message);
+    }
+
+    bool try_read_stream (RawMessage & raw)
+    {
+        if (LOOM_UNLIKELY(chunks_ != nullptr)) {
+            const char * data;
+            uint32_t message_size;
+            if (LOOM_LIKELY(_try_read_chunked(data, message_size))) {
+                memcpy(raw.copy(message_size), data, message_size);
+                return true;
+            } else {
+                return false;
+            }
+        }
+        return _try_read_raw(raw);
     }
 
     bool try_read_stream (std::vector<char> & raw)
     {
-        google::protobuf::io::CodedInputStream coded(stream_);
-        uint32_t message_size = 0;
-        if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
-            auto old_limit = coded.PushLimit(message_size);
-            raw.resize(message_size);
-            bool success = coded.ReadRaw(raw.data(), message_size);
-            LOOM_ASSERT(success, "failed to parse message from " << filename_);
-            coded.PopLimit(old_limit);
-            ++position_;
-            return true;
-        } else {
-            return false;
+        if (LOOM_UNLIKELY(chunks_ != nullptr)) {
+            const char * data;
+            uint32_t message_size;
+            if (LOOM_LIKELY(_try_read_chunked(data, message_size))) {
+                raw.assign(data, data + message_size);
+                return true;
+            } else {
+                return false;
+            }
         }
+        return _try_read_raw(raw);
     }
 
     template<class Message>
@@ -137,8 +241,7 @@ public:
     {
         LOOM_ASSERT2(is_file(), "only files support cyclic_read_stream");
         if (LOOM_UNLIKELY(not try_read_stream(message))) {
-            _close();
-            _open();
+            _rewind();
             bool success = try_read_stream(message);
             LOOM_ASSERT(success, "stream is empty");
         }
@@ -151,21 +254,53 @@ public:
         uint32_t max_message_size;
     };
 
-    static StreamStats stream_stats (const char * filename)
+    // If index is given and filename is an unindexed uncompressed file,
+    // the counting pass also builds an in-memory index for set_index.
+    static StreamStats stream_stats (
+            const char * filename,
+            StreamIndex * index = nullptr)
     {
         InFile file(filename);
+        if (index) {
+            index->Clear();
+        }
 
         StreamStats stats;
         stats.is_file = file.is_file();
         stats.message_count = 0;
         stats.max_message_size = 0;
 
+        if (file.chunks_) {
+            const char * data;
+            uint32_t message_size;
+            while (file._try_read_chunked(data, message_size)) {
+                ++stats.message_count;
+                stats.max_message_size =
+                    std::max(stats.max_message_size, message_size);
+            }
+            return stats;
+        }
+
+        if (file.is_file() and file._load_index()) {
+            stats.message_count = file.index_.message_count();
+            stats.max_message_size = file.index_.max_message_size();
+            return stats;
+        }
+
+        if (index and not file._is_uncompressed_file()) {
+            index = nullptr;
+        }
+        uint64_t offset = 0;
         while (true) {
             google::protobuf::io::CodedInputStream coded(file.stream_);
             uint32_t message_size = 0;
             if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
                 bool success = coded.Skip(message_size);
                 LOOM_ASSERT(success, "failed to count " << filename);
+                if (index and stats.message_count % index_block_size == 0) {
+                    index->add_offsets(offset);
+                }
+                offset += sizeof(message_size) + message_size;
                 ++stats.message_count;
                 stats.max_message_size =
                     std::max(stats.max_message_size, message_size);
@@ -173,16 +308,124 @@ public:
                 break;
             }
         }
+        if (index) {
+            index->set_file_size(offset);
+            index->set_message_count(stats.message_count);
+            index->set_max_message_size(stats.max_message_size);
+            index->set_block_size(index_block_size);
+        }
         return stats;
     }
 
+    // Adopts an index built by stream_stats, if it matches this file,
+    // so that set_position can jump rather than scan.
+    void set_index (const StreamIndex & index)
+    {
+        struct stat info;
+        if (index_state_ != INDEX_LOADED and
+            _is_uncompressed_file() and
+            index.block_size() > 0 and
+            fstat(fid_, & info) == 0 and
+            index.file_size() == static_cast<uint64_t>(info.st_size))
+        {
+            index_ = index;
+            index_state_ = INDEX_LOADED;
+        }
+    }
+
 private:
 
+    template<class Message>
+    bool _try_read_message (Message & message)
+    {
+        if (is_mapped()) {
+            const char * data;
+            uint32_t message_size;
+            if (LOOM_LIKELY(_try_read_mapped(data, message_size))) {
+                bool success = message.ParseFromArray(data, message_size);
+                LOOM_ASSERT(
+                    success,
+                    "failed to parse message from " << filename_);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        google::protobuf::io::CodedInputStream coded(stream_);
+        uint32_t message_size = 0;
+        if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
+            auto old_limit = coded.PushLimit(message_size);
+            bool success = message.ParseFromCodedStream(& coded);
+            LOOM_ASSERT(success, "failed to parse message from " << filename_);
+            coded.PopLimit(old_limit);
+            ++position_;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool _try_read_raw (RawMessage & raw)
+    {
+        if (is_mapped()) {
+            const char * data;
+            uint32_t message_size;
+            if (LOOM_LIKELY(_try_read_mapped(data, message_size))) {
+                raw.borrow(data, message_size);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        google::protobuf::io::CodedInputStream coded(stream_);
+        uint32_t message_size = 0;
+        if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
+            auto old_limit = coded.PushLimit(message_size);
+            bool success = coded.ReadRaw(raw.copy(message_size), message_size);
+            LOOM_ASSERT(success, "failed to parse message from " << filename_);
+            coded.PopLimit(old_limit);
+            ++position_;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool _try_read_raw (std::vector<char> & raw)
+    {
+        if (is_mapped()) {
+            const char * data;
+            uint32_t message_size;
+            if (LOOM_LIKELY(_try_read_mapped(data, message_size))) {
+                raw.assign(data, data + message_size);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        google::protobuf::io::CodedInputStream coded(stream_);
+        uint32_t message_size = 0;
+        if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
+            auto old_limit = coded.PushLimit(message_size);
+            raw.resize(message_size);
+            bool success = coded.ReadRaw(raw.data(), message_size);
+            LOOM_ASSERT(success, "failed to parse message from " << filename_);
+            coded.PopLimit(old_limit);
+            ++position_;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
     void _open ()
     {
         if (filename_.empty()) {
             is_file_ = false;
-        } else if (filename_ == "-" or filename_ == "-.gz") {
+        } else if (is_std_stream(filename_)) {
             is_file_ = false;
             fid_ = STDIN_FILENO;
         } else {
@@ -191,13 +434,34 @@ private:
             LOOM_ASSERT(fid_ != -1, "failed to open input file " << filename_);
         }
 
+        mapped_ = nullptr;
+        mapped_size_ = 0;
+        mapped_pos_ = 0;
+        if ((flags_ & MMAP) and is_file_ and
+            not is_compressed(filename_.c_str()))
+        {
+            _map();
+        }
+        if (is_file_ and not is_mapped()) {
+            posix_fadvise(fid_, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+
         file_ = new google::protobuf::io::FileInputStream(fid_);
 
-        if (endswith(filename_.c_str(), ".gz")) {
-            gzip_ = new google::protobuf::io::GzipInputStream(file_);
-            stream_ = gzip_;
+        gzip_ = nullptr;
+        block_gzip_ = nullptr;
+        codec_ = new_decoding_stream(filename_.c_str(), file_);
+        if (codec_) {
+            stream_ = codec_;
+        } else if (endswith(filename_.c_str(), ".gz")) {
+            if (BlockGzipInputStream::sniff(file_)) {
+                block_gzip_ = new BlockGzipInputStream(file_);
+                stream_ = block_gzip_;
+            } else {
+                gzip_ = new google::protobuf::io::GzipInputStream(file_);
+                stream_ = gzip_;
+            }
         } else {
-            gzip_ = nullptr;
             stream_ = file_;
         }
 
@@ -206,20 +470,274 @@ private:
 
     void _close ()
     {
+        delete codec_;
+        delete block_gzip_;
         delete gzip_;
         delete file_;
+        if (is_mapped()) {
+            munmap(const_cast<char *>(mapped_), mapped_size_);
+        }
         if (is_file()) {
             close(fid_);
         }
     }
 
+    // Mapped files are rewound without unmapping,
+    // so that borrowed RawMessages survive cyclic reads.
+    void _rewind ()
+    {
+        if (chunks_) {
+            chunks_->clear();
+        }
+        if (is_mapped()) {
+            mapped_pos_ = 0;
+            position_ = 0;
+        } else {
+            _close();
+            _open();
+        }
+    }
+
+    void _map ()
+    {
+        struct stat info;
+        if (fstat(fid_, & info) == 0 and S_ISREG(info.st_mode) and
+            info.st_size > 0)
+        {
+            void * data = mmap(
+                nullptr,
+                info.st_size,
+                PROT_READ,
+                MAP_PRIVATE,
+                fid_,
+                0);
+            LOOM_ASSERT(data != MAP_FAILED, "failed to mmap " << filename_);
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            mapped_ = static_cast<const char *>(data);
+            mapped_size_ = info.st_size;
+        }
+    }
+
+    bool _is_uncompressed_file () const
+    {
+        return is_file_ and gzip_ == nullptr and codec_ == nullptr and
+            block_gzip_ == nullptr and chunks_ == nullptr;
+    }
+
+    // Block gzip files are seekable only if indexed by member.
+    bool _is_seekable () const
+    {
+        return is_file_ and gzip_ == nullptr and codec_ == nullptr and
+            chunks_ == nullptr and (
+            block_gzip_ == nullptr or
+            index_.member_offsets_size() == index_.offsets_size());
+    }
+
+    void _seek (uint64_t block)
+    {
+        const uint64_t offset = index_.offsets(block);
+        if (is_mapped()) {
+            LOOM_ASSERT_LE(offset, mapped_size_);
+            mapped_pos_ = offset;
+        } else if (block_gzip_) {
+            delete block_gzip_;
+            delete file_;
+            const uint64_t member_offset = index_.member_offsets(block);
+            off_t status = lseek(fid_, member_offset, SEEK_SET);
+            LOOM_ASSERT(status != -1, "failed to seek in " << filename_);
+            file_ = new google::protobuf::io::FileInputStream(fid_);
+            block_gzip_ = new BlockGzipInputStream(file_);
+            stream_ = block_gzip_;
+            bool success = block_gzip_->Skip(
+                offset - index_.member_starts(block));
+            LOOM_ASSERT(success, "failed to seek in " << filename_);
+        } else {
+            delete file_;
+            off_t success = lseek(fid_, offset, SEEK_SET);
+            LOOM_ASSERT(success != -1, "failed to seek in " << filename_);
+            file_ = new google::protobuf::io::FileInputStream(fid_);
+            stream_ = file_;
+        }
+        position_ = block * index_.block_size();
+    }
+
+    // The index is loaded lazily and ignored if stale.
+    bool _load_index ()
+    {
+        if (index_state_ == INDEX_UNKNOWN and is_file_) {
+            index_state_ = INDEX_MISSING;
+            const std::string index_path = get_index_path(filename_);
+            struct stat info;
+            if (fstat(fid_, & info) == 0 and
+                access(index_path.c_str(), R_OK) == 0)
+            {
+                InFile(index_path.c_str()).read(index_);
+                if (index_.file_size() == static_cast<uint64_t>(info.st_size)
+                    and index_.block_size() > 0)
+                {
+                    index_state_ = INDEX_LOADED;
+                }
+            }
+        }
+        return index_state_ == INDEX_LOADED;
+    }
+
+    // In row chunk files, position_ counts rows rather than chunks.
+    template<class Next>
+    bool _try_read_chunked_with (const Next & next)
+    {
+        while (LOOM_UNLIKELY(not next())) {
+            if (not _try_read_chunk()) {
+                return false;
+            }
+            chunks_->decode(chunk_.data(), chunk_.size());
+        }
+        ++position_;
+        return true;
+    }
+
+    bool _try_read_chunked (RowChunkDecoder::Row & row)
+    {
+        return _try_read_chunked_with([&](){
+            return chunks_->try_next(row);
+        });
+    }
+
+    bool _try_read_chunked (const char * & data, uint32_t & message_size)
+    {
+        return _try_read_chunked_with([&](){
+            return chunks_->try_next(data, message_size);
+        });
+    }
+
+    template<class Message>
+    bool _try_read_chunked (Message &)
+    {
+        LOOM_ERROR("row chunk file holds only rows: " << filename_);
+        return false;
+    }
+
+    bool _try_read_chunk ()
+    {
+        const uint64_t position = position_;
+        bool success = _try_read_raw(chunk_);
+        position_ = position;
+        return success;
+    }
+
+    // Whole chunks are skipped without being decoded.
+    void _set_chunked_position (uint64_t target)
+    {
+        if (target < position_) {
+            _rewind();
+        }
+
+        const uint64_t skipped =
+            std::min<uint64_t>(target - position_, chunks_->remaining());
+        chunks_->skip(skipped);
+        position_ += skipped;
+
+        while (position_ < target) {
+            bool success = _try_read_chunk();
+            LOOM_ASSERT(success, "failed to set position of " << filename_);
+            const uint64_t row_count = RowChunkDecoder::peek_row_count(
+                chunk_.data(),
+                chunk_.size());
+            if (position_ + row_count <= target) {
+                position_ += row_count;
+            } else {
+                chunks_->decode(chunk_.data(), chunk_.size());
+                chunks_->skip(target - position_);
+                position_ = target;
+            }
+        }
+    }
+
+    bool _try_read_mapped (const char * & data, uint32_t & message_size)
+    {
+        if (LOOM_UNLIKELY(mapped_pos_ + 4 > mapped_size_)) {
+            return false;
+        }
+        const auto * header =
+            reinterpret_cast<const google::protobuf::uint8 *>(
+                mapped_ + mapped_pos_);
+        google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray(
+            header,
+            & message_size);
+        mapped_pos_ += 4;
+        LOOM_ASSERT(
+            mapped_pos_ + message_size <= mapped_size_,
+            "truncated message in " << filename_);
+        data = mapped_ + mapped_pos_;
+        mapped_pos_ += message_size;
+        ++position_;
+        return true;
+    }
+
     const std::string filename_;
     int fid_;
+    const int flags_;
     bool is_file_;
+    enum { index_block_size = 1024 };
+
+    const char * mapped_;
+    size_t mapped_size_;
+    size_t mapped_pos_;
+    enum { INDEX_UNKNOWN, INDEX_MISSING, INDEX_LOADED } index_state_;
+    StreamIndex index_;
     google::protobuf::io::FileInputStream * file_;
     google::protobuf::io::GzipInputStream * gzip_;
+    BlockGzipInputStream * block_gzip_;
+    DecodingInputStream * codec_;
     google::protobuf::io::ZeroCopyInputStream * stream_;
     uint64_t position_;
+    RowChunkDecoder * const chunks_;
+    RawMessage chunk_;
+};
+
+// A message stream held in memory, e.g. a section of a mapped snapshot.
+// The data must outlive the InBuffer.
+class InBuffer : noncopyable
+{
+public:
+
+    InBuffer (const char * data, size_t size) :
+        data_(data),
+        size_(size),
+        pos_(0),
+        position_(0)
+    {
+    }
+
+    uint64_t position () const { return position_; }
+
+    template<class Message>
+    bool try_read_stream (Message & message)
+    {
+        if (LOOM_UNLIKELY(pos_ + 4 > size_)) {
+            return false;
+        }
+        uint32_t message_size;
+        google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray(
+            reinterpret_cast<const google::protobuf::uint8 *>(data_ + pos_),
+            & message_size);
+        pos_ += 4;
+        LOOM_ASSERT(
+            pos_ + message_size <= size_,
+            "truncated message in buffer");
+        bool success = message.ParseFromArray(data_ + pos_, message_size);
+        LOOM_ASSERT(success, "failed to parse message from buffer");
+        pos_ += message_size;
+        ++position_;
+        return true;
+    }
+
+private:
+
+    const char * const data_;
+    const size_t size_;
+    size_t pos_;
+    uint64_t position_;
 };
 
 
@@ -227,24 +745,48 @@ class OutFile : noncopyable
 {
 public:
 
-    enum { APPEND = O_APPEND };
+    enum { APPEND = O_APPEND, INDEXED = 1 << 30, BLOCK_GZIP = 1 << 29 };
 
-    OutFile (int fid) : fid_(fid)
+    enum { index_block_size = 1024 };
+
+    OutFile (int fid) : fid_(fid), indexed_(false)
     {
         _open();
     }
 
-    OutFile (const char * filename, int flags = 0) : filename_(filename)
+    OutFile (const char * filename, int flags = 0) :
+        filename_(filename),
+        indexed_(flags & INDEXED)
     {
         LOOM_ASSERT(not filename_.empty(), "empty filename is not supported");
+        LOOM_ASSERT(
+            not (indexed_ and (flags & APPEND)),
+            "cannot index a stream opened for append: " << filename_);
         _open(flags);
+        if (indexed_) {
+            index_.set_message_count(0);
+            index_.set_max_message_size(0);
+        } else if (is_file_ and not (flags & APPEND)) {
+            unlink(get_index_path(filename_).c_str());  // drop stale index
+        }
     }
 
     ~OutFile ()
     {
+        if (block_gzip_) {
+            block_gzip_->Close();
+            if (indexed_) {
+                _index_members();
+            }
+        }
+        delete codec_;
+        delete block_gzip_;
         delete gzip_;
         delete file_;
         if (is_file()) {
+            if (indexed_) {
+                _write_index();
+            }
             close(fid_);
         }
     }
@@ -263,18 +805,30 @@ public:
     template<class Message>
     void write_stream (Message & message)
     {
-        google::protobuf::io::CodedOutputStream coded(stream_);
         LOOM_ASSERT1(message.IsInitialized(), "message not initialized");
         uint32_t message_size = message.ByteSize();
+        _index(message_size);
+        google::protobuf::io::CodedOutputStream coded(stream_);
         coded.WriteLittleEndian32(message_size);
         message.SerializeWithCachedSizes(& coded);
     }
 
     void write_stream (const std::vector<char> & raw)
     {
+        write_stream(raw.data(), raw.size());
+    }
+
+    void write_stream (const RawMessage & raw)
+    {
+        write_stream(raw.data(), raw.size());
+    }
+
+    void write_stream (const char * data, size_t size)
+    {
+        _index(size);
         google::protobuf::io::CodedOutputStream coded(stream_);
-        coded.WriteLittleEndian32(raw.size());
-        coded.WriteRaw(raw.data(), raw.size());
+        coded.WriteLittleEndian32(size);
+        coded.WriteRaw(data, size);
     }
 
     void flush ()
@@ -282,6 +836,12 @@ public:
         if (gzip_) {
             gzip_->Flush();
         }
+        if (block_gzip_) {
+            block_gzip_->Flush();
+        }
+        if (codec_) {
+            codec_->Flush();
+        }
         file_->Flush();
     }
 
@@ -291,33 +851,86 @@ private:
     {
         if (filename_.empty()) {
             is_file_ = false;
-        } else if (filename_ == "-" or filename_ == "-.gz") {
+        } else if (is_std_stream(filename_)) {
             is_file_ = false;
             fid_ = STDOUT_FILENO;
         } else {
             is_file_ = true;
             fid_ = open(
                 filename_.c_str(),
-                O_WRONLY | O_CREAT | O_TRUNC | flags, 0664);
+                O_WRONLY | O_CREAT | O_TRUNC | (flags & APPEND), 0664);
             LOOM_ASSERT(fid_ != -1, "failed to open output file " << filename_);
         }
 
         file_ = new google::protobuf::io::FileOutputStream(fid_);
 
-        if (endswith(filename_.c_str(), ".gz")) {
-            gzip_ = new google::protobuf::io::GzipOutputStream(file_);
-            stream_ = gzip_;
+        gzip_ = nullptr;
+        block_gzip_ = nullptr;
+        codec_ = new_encoding_stream(filename_.c_str(), file_);
+        if (codec_) {
+            stream_ = codec_;
+        } else if (endswith(filename_.c_str(), ".gz")) {
+            if (flags & BLOCK_GZIP) {
+                block_gzip_ = new BlockGzipOutputStream(file_);
+                stream_ = block_gzip_;
+            } else {
+                gzip_ = new google::protobuf::io::GzipOutputStream(file_);
+                stream_ = gzip_;
+            }
         } else {
-            gzip_ = nullptr;
             stream_ = file_;
         }
     }
 
+    void _index (uint32_t message_size)
+    {
+        if (indexed_) {
+            if (index_.message_count() % index_block_size == 0) {
+                index_.add_offsets(stream_->ByteCount());
+            }
+            index_.set_message_count(index_.message_count() + 1);
+            if (message_size > index_.max_message_size()) {
+                index_.set_max_message_size(message_size);
+            }
+        }
+    }
+
+    // maps each indexed offset to its enclosing block gzip member
+    void _index_members ()
+    {
+        const auto & member_offsets = block_gzip_->member_offsets();
+        const auto & member_starts = block_gzip_->member_starts();
+        for (uint64_t offset : index_.offsets()) {
+            auto pos = std::upper_bound(
+                member_starts.begin(),
+                member_starts.end(),
+                offset);
+            LOOM_ASSERT(pos != member_starts.begin(), "bad offset " << offset);
+            const size_t member = pos - member_starts.begin() - 1;
+            index_.add_member_offsets(member_offsets[member]);
+            index_.add_member_starts(member_starts[member]);
+        }
+    }
+
+    void _write_index ()
+    {
+        struct stat info;
+        int status = fstat(fid_, & info);
+        LOOM_ASSERT(status == 0, "failed to stat " << filename_);
+        index_.set_file_size(info.st_size);
+        index_.set_block_size(index_block_size);
+        OutFile(get_index_path(filename_).c_str()).write(index_);
+    }
+
     const std::string filename_;
     int fid_;
     bool is_file_;
+    const bool indexed_;
+    StreamIndex index_;
     google::protobuf::io::FileOutputStream * file_;
     google::protobuf::io::GzipOutputStream * gzip_;
+    BlockGzipOutputStream * block_gzip_;
+    EncodingOutputStream * codec_;
     google::protobuf::io::ZeroCopyOutputStream * stream_;
 };
 
@@ -38,6 +38,7 @@ const char * help_message =
 "\nArguments:"
 "\n  ROOT_IN         root dirname of dataset in loom store"
 "\n  REQUESTS_IN     filename of requests stream (e.g. requests.pbs.gz)"
+"\n                  or socket address unix:PATH or tcp:PORT to listen on"
 "\n  CONFIG_IN       filename of query config (e.g. config.pb.gz)"
 "\n  RESPONSES_OUT   filename of responses stream (e.g. responses.pbs.gz)"
 "\n  LOG_OUT         filename of log (e.g. log.pbs.gz)"
@@ -45,6 +46,8 @@ const char * help_message =
 "\nNotes:"
 "\n  Any filename can end with .gz to indicate gzip compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
+"\n  When listening on a socket, RESPONSES_OUT is ignored, and responses"
+"\n  are written back on each client's connection."
 ;
 
 int main (int argc, char ** argv)
@@ -74,7 +77,11 @@ int main (int argc, char ** argv)
     loom::QueryServer server(engine.cross_cats(), config, rows_in);
     loom::rng_t rng(config.seed());
 
-    server.serve(rng, requests_in, responses_out);
+    if (loom::QueryServer::is_socket_address(requests_in)) {
+        server.serve_socket(rng, requests_in);
+    } else {
+        server.serve(rng, requests_in, responses_out);
+    }
 
     return 0;
 }
@@ -26,6 +26,20 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <omp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 #include <loom/query_server.hpp>
 #include <loom/compressed_vector.hpp>
 #include <loom/scorer.hpp>
@@ -39,6 +53,11 @@ void QueryServer::serve (
         const char * requests_in,
         const char * responses_out)
 {
+    if (thread_count_ > 1) {
+        serve_concurrently(rng, requests_in, responses_out);
+        return;
+    }
+
     protobuf::InFile query_stream(requests_in);
     protobuf::OutFile response_stream(responses_out);
     protobuf::Query::Request request;
@@ -46,24 +65,464 @@ void QueryServer::serve (
 
     while (query_stream.try_read_stream(request)) {
         Timer::Scope timer(timer_);
-        response.Clear();
-        response.set_id(request.id());
-        Errors & errors = * response.mutable_error();
-        if (request.has_sample() and validate(request.sample(), errors)) {
-            call(rng, request.sample(), * response.mutable_sample());
+        process(rng, request, response);
+        response_stream.write_stream(response);
+        response_stream.flush();
+    }
+}
+
+void QueryServer::process (
+        rng_t & rng,
+        const Query::Request & request,
+        Query::Response & response) const
+{
+    // score derivative requests temporarily modify the shared cross cats
+    if (request.has_score_derivative()) {
+        pthread_rwlock_wrlock(& cross_cats_lock_);
+    } else {
+        pthread_rwlock_rdlock(& cross_cats_lock_);
+    }
+
+    response.Clear();
+    response.set_id(request.id());
+    Errors & errors = * response.mutable_error();
+    if (request.has_sample() and validate(request.sample(), errors)) {
+        call(rng, request.sample(), * response.mutable_sample());
+    }
+    if (request.has_score() and validate(request.score(), errors)) {
+        call(rng, request.score(), * response.mutable_score());
+    }
+    if (request.has_entropy() and validate(request.entropy(), errors)) {
+        call(rng, request.entropy(), * response.mutable_entropy());
+    }
+    if (request.has_score_derivative() and
+        validate(request.score_derivative(), errors))
+    {
+        call(
+            rng,
+            request.score_derivative(),
+            * response.mutable_score_derivative());
+    }
+
+    pthread_rwlock_unlock(& cross_cats_lock_);
+}
+
+static int bind_socket (const char * address)
+{
+    int fid;
+    if (strncmp(address, "unix:", 5) == 0) {
+        const char * path = address + 5;
+        sockaddr_un addr;
+        memset(& addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        LOOM_ASSERT(
+            strlen(path) < sizeof(addr.sun_path),
+            "socket path is too long: " << path);
+        strcpy(addr.sun_path, path);
+        unlink(path);  // drop stale socket
+        fid = socket(AF_UNIX, SOCK_STREAM, 0);
+        LOOM_ASSERT(fid != -1, "failed to create socket " << address);
+        int status = bind(
+            fid,
+            reinterpret_cast<const sockaddr *>(& addr),
+            sizeof(addr));
+        LOOM_ASSERT(status == 0, "failed to bind " << address);
+    } else {
+        const int port = atoi(address + 4);
+        LOOM_ASSERT(0 < port and port < 65536, "invalid port: " << address);
+        sockaddr_in addr;
+        memset(& addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        fid = socket(AF_INET, SOCK_STREAM, 0);
+        LOOM_ASSERT(fid != -1, "failed to create socket " << address);
+        int reuse = 1;
+        setsockopt(fid, SOL_SOCKET, SO_REUSEADDR, & reuse, sizeof(reuse));
+        int status = bind(
+            fid,
+            reinterpret_cast<const sockaddr *>(& addr),
+            sizeof(addr));
+        LOOM_ASSERT(status == 0, "failed to bind " << address);
+    }
+    int status = listen(fid, SOMAXCONN);
+    LOOM_ASSERT(status == 0, "failed to listen on " << address);
+    return fid;
+}
+
+static volatile sig_atomic_t stop_serving_socket = 0;
+
+static void handle_stop_signal (int)
+{
+    stop_serving_socket = 1;
+}
+
+namespace
+{
+struct SocketConnection
+{
+    std::string buffer;  // received bytes not yet framed
+    bool busy;  // a request is being served, so responses stay in order
+    bool hung_up;
+
+    SocketConnection () : busy(false), hung_up(false) {}
+};
+
+struct SocketRequest
+{
+    int connection;
+    std::string message;
+};
+
+// a client hanging up fails the send rather than raising SIGPIPE
+bool send_all (int fid, const std::string & buffer)
+{
+    for (size_t pos = 0; pos < buffer.size();) {
+        const ssize_t size = send(
+            fid,
+            buffer.data() + pos,
+            buffer.size() - pos,
+            MSG_NOSIGNAL);
+        if (size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pos += size;
+    }
+    return true;
+}
+} // anonymous namespace
+
+// The calling thread polls the listening socket and every idle connection,
+// splits received bytes into framed requests, and queues them for a pool of
+// config.query.threads workers, each with its own rng. Workers parse,
+// process and answer one request at a time, so any number of connections
+// share the workers. Each connection has at most one request in flight,
+// so its responses come back in request order. Malformed input drops only
+// its connection. SIGINT or SIGTERM stops polling, drops queued requests,
+// hangs up on open connections, and joins the workers.
+void QueryServer::serve_socket (rng_t & rng, const char * address)
+{
+    LOOM_ASSERT(is_socket_address(address), "invalid address: " << address);
+
+    multiplexing_ = true;
+
+    // nothing the polling thread does may block, nor a worker waking it
+    const int fid = bind_socket(address);
+    int wake_pipe[2];
+    LOOM_ASSERT(pipe(wake_pipe) == 0, "failed to create pipe");
+    for (int nonblocking : {fid, wake_pipe[0], wake_pipe[1]}) {
+        fcntl(nonblocking, F_SETFL, fcntl(nonblocking, F_GETFL) | O_NONBLOCK);
+    }
+
+    // connections are touched only by the polling thread
+    std::unordered_map<int, SocketConnection> connections;
+    std::deque<SocketRequest> pending;
+    std::vector<std::pair<int, bool>> finished;  // connection, answered
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable cond_variable;
+
+    // workers inherit this mask, so stop signals interrupt only poll
+    sigset_t stop_signals;
+    sigemptyset(& stop_signals);
+    sigaddset(& stop_signals, SIGINT);
+    sigaddset(& stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, & stop_signals, nullptr);
+
+    const auto seed = rng();
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < thread_count_; ++w) {
+        workers.push_back(std::thread([&, w](){
+            rng_t rng(seed + w);
+            SocketRequest task;
+            Query::Request request;
+            Query::Response response;
+            std::string output;
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cond_variable.wait(lock, [&](){
+                    return stopping or not pending.empty();
+                });
+                if (stopping) {
+                    break;
+                }
+                task.connection = pending.front().connection;
+                task.message.swap(pending.front().message);
+                pending.pop_front();
+                lock.unlock();
+
+                bool answered = request.ParseFromString(task.message);
+                if (answered) {
+                    process(rng, request, response);
+                    const uint32_t message_size = response.ByteSize();
+                    output.resize(sizeof(message_size) + message_size);
+                    auto * data = reinterpret_cast<google::protobuf::uint8 *>(
+                        & output[0]);
+                    google::protobuf::io::CodedOutputStream::
+                        WriteLittleEndian32ToArray(message_size, data);
+                    response.SerializeWithCachedSizesToArray(
+                        data + sizeof(message_size));
+                    answered = send_all(task.connection, output);
+                }
+
+                lock.lock();
+                finished.push_back(std::make_pair(task.connection, answered));
+                if (finished.size() == 1) {
+                    const char wake = 0;
+                    if (write(wake_pipe[1], & wake, 1) == -1) {
+                        LOOM_ASSERT(
+                            errno == EAGAIN or errno == EINTR,
+                            "failed to wake query server");
+                    }
+                }
+            }
+        }));
+    }
+
+    // queues the next complete request, or closes a hung up idle connection
+    auto dispatch = [&](int connection){
+        SocketConnection & state = connections[connection];
+        const uint32_t max_message_size = 64 << 20;
+        uint32_t message_size = 0;
+        if (not state.busy and state.buffer.size() >= sizeof(message_size)) {
+            google::protobuf::io::CodedInputStream::
+                ReadLittleEndian32FromArray(
+                    reinterpret_cast<const google::protobuf::uint8 *>(
+                        state.buffer.data()),
+                    & message_size);
+            const size_t frame_size = sizeof(message_size) + message_size;
+            if (message_size > max_message_size) {
+                state.hung_up = true;
+            } else if (state.buffer.size() >= frame_size) {
+                std::unique_lock<std::mutex> lock(mutex);
+                pending.push_back(SocketRequest());
+                pending.back().connection = connection;
+                pending.back().message.assign(
+                    state.buffer,
+                    sizeof(message_size),
+                    message_size);
+                state.buffer.erase(0, frame_size);
+                state.busy = true;
+                cond_variable.notify_one();
+            }
         }
-        if (request.has_score() and validate(request.score(), errors)) {
-            call(rng, request.score(), * response.mutable_score());
+        if (state.hung_up and not state.busy) {
+            close(connection);
+            connections.erase(connection);
         }
-        if (request.has_entropy() and validate(request.entropy(), errors)) {
-            call(rng, request.entropy(), * response.mutable_entropy());
+    };
+
+    stop_serving_socket = 0;
+    struct sigaction action;
+    memset(& action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, & action, nullptr);
+    sigaction(SIGTERM, & action, nullptr);
+    pthread_sigmask(SIG_UNBLOCK, & stop_signals, nullptr);
+
+    std::vector<pollfd> polled;
+    std::vector<std::pair<int, bool>> done;
+    std::vector<char> chunk(1 << 16);
+    while (not stop_serving_socket) {
+        polled.clear();
+        polled.push_back({fid, POLLIN, 0});
+        polled.push_back({wake_pipe[0], POLLIN, 0});
+        for (const auto & pair : connections) {
+            if (not pair.second.busy) {
+                polled.push_back({pair.first, POLLIN, 0});
+            }
         }
-        if (request.has_score_derivative() and validate(request.score_derivative(), errors)) {
-            call(rng, request.score_derivative(), * response.mutable_score_derivative());
+        if (poll(polled.data(), polled.size(), -1) == -1) {
+            LOOM_ASSERT(errno == EINTR, "failed to poll " << address);
+            continue;
+        }
+
+        if (polled[1].revents) {
+            while (read(wake_pipe[0], chunk.data(), chunk.size()) > 0) {}
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                done.swap(finished);
+            }
+            for (const auto & pair : done) {
+                SocketConnection & state = connections[pair.first];
+                state.busy = false;
+                state.hung_up = state.hung_up or not pair.second;
+                dispatch(pair.first);
+            }
+            done.clear();
+        }
+
+        for (size_t i = 2; i < polled.size(); ++i) {
+            if (polled[i].revents) {
+                const int connection = polled[i].fd;
+                const ssize_t size =
+                    read(connection, chunk.data(), chunk.size());
+                if (size > 0) {
+                    connections[connection].buffer.append(chunk.data(), size);
+                } else if (size == 0 or errno != EINTR) {
+                    connections[connection].hung_up = true;
+                }
+                dispatch(connection);
+            }
+        }
+
+        if (polled[0].revents) {
+            const int connection = accept(fid, nullptr, nullptr);
+            if (connection == -1) {
+                LOOM_ASSERT(
+                    errno == EINTR or errno == ECONNABORTED or
+                    errno == EAGAIN or errno == EWOULDBLOCK,
+                    "failed to accept on " << address);
+            } else {
+                connections[connection] = SocketConnection();
+            }
+        }
+    }
+
+    close(fid);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+        pending.clear();
+        for (const auto & pair : connections) {
+            shutdown(pair.first, SHUT_RDWR);
+        }
+        cond_variable.notify_all();
+    }
+    for (auto & worker : workers) {
+        worker.join();
+    }
+    for (const auto & pair : connections) {
+        close(pair.first);
+    }
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    if (strncmp(address, "unix:", 5) == 0) {
+        unlink(address + 5);
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    multiplexing_ = false;
+}
+
+struct QueryServer::Task
+{
+    Query::Request request;
+    Query::Response response;
+    bool done;
+};
+
+// The calling thread reads requests into a bounded window of tasks,
+// which a pool of workers, each with its own rng, processes in parallel.
+// Whichever thread finishes a task writes every response that is ready.
+// Score derivative requests temporarily modify the shared cross cats,
+// so each runs alone, after all earlier requests have finished.
+void QueryServer::serve_concurrently (
+        rng_t & rng,
+        const char * requests_in,
+        const char * responses_out)
+{
+    protobuf::InFile query_stream(requests_in);
+    protobuf::OutFile response_stream(responses_out);
+    const bool ordered = config_.query().ordered();
+
+    std::vector<Task> tasks(4 * thread_count_);
+    std::vector<Task *> free_tasks;
+    for (auto & task : tasks) {
+        free_tasks.push_back(& task);
+    }
+    std::deque<Task *> pending;
+    std::deque<Task *> unwritten;
+    size_t busy = 0;
+    bool reading = true;
+    std::mutex mutex;
+    std::condition_variable cond_variable;
+
+    // this must be called with mutex held
+    auto finish = [&](Task * task){
+        task->done = true;
+        if (ordered) {
+            while (not unwritten.empty() and unwritten.front()->done) {
+                response_stream.write_stream(unwritten.front()->response);
+                free_tasks.push_back(unwritten.front());
+                unwritten.pop_front();
+            }
+        } else {
+            response_stream.write_stream(task->response);
+            free_tasks.push_back(task);
         }
-        response_stream.write_stream(response);
         response_stream.flush();
+        cond_variable.notify_all();
+    };
+
+    const auto seed = rng();
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < thread_count_; ++i) {
+        workers.push_back(std::thread([&, i](){
+            rng_t rng(seed + i);
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cond_variable.wait(lock, [&]{
+                    return not (pending.empty() and reading);
+                });
+                if (pending.empty()) {
+                    break;
+                }
+                Task * task = pending.front();
+                pending.pop_front();
+                ++busy;
+                lock.unlock();
+                process(rng, task->request, task->response);
+                lock.lock();
+                --busy;
+                finish(task);
+            }
+        }));
     }
+
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond_variable.wait(lock, [&]{ return not free_tasks.empty(); });
+        Task * task = free_tasks.back();
+        free_tasks.pop_back();
+        lock.unlock();
+
+        if (not query_stream.try_read_stream(task->request)) {
+            break;
+        }
+
+        lock.lock();
+        task->done = false;
+        if (ordered) {
+            unwritten.push_back(task);
+        }
+        if (task->request.has_score_derivative()) {
+            cond_variable.wait(lock, [&]{
+                return pending.empty() and busy == 0;
+            });
+            lock.unlock();
+            process(rng, task->request, task->response);
+            lock.lock();
+            finish(task);
+        } else {
+            pending.push_back(task);
+            cond_variable.notify_all();
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        reading = false;
+    }
+    cond_variable.notify_all();
+    for (auto & worker : workers) {
+        worker.join();
+    }
+    LOOM_ASSERT(unwritten.empty(), "unwritten responses remain");
 }
 
 bool QueryServer::validate (
@@ -267,37 +726,47 @@ bool QueryServer::validate (
 
 namespace
 {
+// Running mean and variance, mergeable across threads (Chan et al.)
 class Accum
 {
-    typedef distributions::NormalInverseChiSq::Shared Shared;
-    typedef distributions::NormalInverseChiSq::Group Group;
-
-    Group group_;
+    size_t count_;
+    double mean_;
+    double count_times_variance_;
 
 public:
 
-    Accum ()
+    Accum () : count_(0), mean_(0), count_times_variance_(0) {}
+
+    void add (float x)
     {
-        static rng_t rng;
-        static Shared shared;
-        group_.init(shared, rng);
+        ++count_;
+        const double delta = x - mean_;
+        mean_ += delta / count_;
+        count_times_variance_ += delta * (x - mean_);
     }
 
-    void add (float x)
+    void merge (const Accum & other)
     {
-        static rng_t rng;
-        static Shared shared;
-        group_.add_value(shared, x, rng);
+        if (other.count_ == 0) {
+            return;
+        }
+        const size_t count = count_ + other.count_;
+        const double delta = other.mean_ - mean_;
+        const double weight = double(count_) * other.count_ / count;
+        mean_ += delta * other.count_ / count;
+        count_times_variance_ +=
+            other.count_times_variance_ + delta * delta * weight;
+        count_ = count;
     }
 
     float mean () const
     {
-        return group_.mean;
+        return mean_;
     }
 
     float variance () const
     {
-        return group_.count_times_variance / (group_.count - 1);
+        return count_times_variance_ / (count_ - 1);
     }
 };
 } // anonymous namespace
@@ -341,13 +810,6 @@ void QueryServer::call (
     const size_t cell_count = row_count * col_count;
     const size_t latent_count = cross_cats_.size();
 
-    std::vector<RestrictionScorer *> scorers(latent_count, nullptr);
-    for (size_t l = 0; l < latent_count; ++l) {
-        scorers[l] = new RestrictionScorer(
-            *cross_cats_[l],
-            request.conditional(),
-            rng);
-    }
     const float score_shift =
         distributions::fast_log(latent_count) + base_score;
 
@@ -368,41 +830,66 @@ void QueryServer::call (
     tasks.init_index();
 
     const size_t task_count = tasks.unique_count();
-    for (size_t t = 0; t < task_count; ++t) {
-        tasks.unique_value(t, union_set);
+
+    // Each thread owns one set of scorers and accumulators, which merge in
+    // thread order at the end. Every sample is scored with an rng seeded
+    // by its index, so results do not depend on which thread scores it.
+    const size_t sample_count = sample_response.samples_size();
+    const bool parallel = config_.query().parallel() and
+        thread_count_ == 1 and not multiplexing_;
+    const size_t thread_count = parallel ? omp_get_max_threads() : 1;
+    std::vector<std::vector<Accum>> thread_accums(
+        thread_count,
+        std::vector<Accum>(task_count));
+
+    const auto scorer_seed = rng();
+    const auto sample_seed = rng();
+    #pragma omp parallel if(parallel) num_threads(thread_count)
+    {
+        rng_t rng(scorer_seed);
+        std::vector<RestrictionScorer *> scorers(latent_count, nullptr);
         for (size_t l = 0; l < latent_count; ++l) {
-            scorers[l]->add_restriction(union_set);
+            scorers[l] = new RestrictionScorer(
+                *cross_cats_[l],
+                request.conditional(),
+                rng);
+        }
+        ProductValue::Observed restriction;
+        for (size_t t = 0; t < task_count; ++t) {
+            tasks.unique_value(t, restriction);
+            for (size_t l = 0; l < latent_count; ++l) {
+                scorers[l]->add_restriction(restriction);
+            }
         }
-    }
 
-    std::vector<Accum> accums(task_count);
-    #pragma omp parallel if(config_.query().parallel())
-    {
+        std::vector<Accum> & accums = thread_accums[omp_get_thread_num()];
         VectorFloat scores(latent_count);
-        for (const auto & sample : sample_response.samples()) {
-
-            #pragma omp barrier
-            #pragma omp for
+        #pragma omp for schedule(static)
+        for (size_t s = 0; s < sample_count; ++s) {
+            rng.seed(sample_seed + s);
+            const auto & sample = sample_response.samples(s);
             for (size_t l = 0; l < latent_count; ++l) {
                 scorers[l]->set_value(sample.pos(), rng);
             }
-
-            #pragma omp barrier
-            #pragma omp for
             for (size_t t = 0; t < task_count; ++t) {
                 for (size_t l = 0; l < latent_count; ++l) {
                     scores[l] = scorers[l]->get_score(t);
                 }
                 float score = score_shift - distributions::log_sum_exp(scores);
-
-                // FIXME this should be atomic
                 accums[t].add(score);
             }
         }
+
+        for (auto scorer : scorers) {
+            delete scorer;
+        }
     }
 
-    for (auto scorer : scorers) {
-        delete scorer;
+    std::vector<Accum> & accums = thread_accums[0];
+    for (size_t i = 1; i < thread_count; ++i) {
+        for (size_t t = 0; t < task_count; ++t) {
+            accums[t].merge(thread_accums[i][t]);
+        }
     }
     for (size_t i = 0; i < cell_count; ++i) {
         const Accum & accum = accums[tasks.unique_id(i)];
@@ -441,6 +928,67 @@ bool QueryServer::validate (
     return true;
 }
 
+// This matches call(rng, Score::Request, ...) row by row, but scores
+// each kind's batch of values at once via ProductMixture::score_values.
+void QueryServer::score_batch (
+        rng_t & rng,
+        const std::vector<const ProductValue::Diff *> & data,
+        VectorFloat & scores_out) const
+{
+    const auto NONE = ProductValue::Observed::NONE;
+    const size_t row_count = data.size();
+    const size_t latent_count = cross_cats_.size();
+    std::vector<VectorFloat> latent_scores(
+        row_count,
+        VectorFloat(latent_count, 0.f));
+    std::vector<std::vector<ProductValue::Diff>> partial_diffs(row_count);
+    std::vector<const ProductValue *> values;
+    std::vector<size_t> rows;
+    std::vector<VectorFloat> scores;
+    VectorFloat diff_scores;
+
+    for (size_t l = 0; l < latent_count; ++l) {
+        const auto & cross_cat = * cross_cats_[l];
+        for (size_t r = 0; r < row_count; ++r) {
+            cross_cat.splitter.split(* data[r], partial_diffs[r]);
+        }
+
+        const size_t kind_count = cross_cat.kinds.size();
+        for (size_t k = 0; k < kind_count; ++k) {
+            auto & kind = cross_cat.kinds[k];
+            const ProductModel & model = kind.model;
+            auto & mixture = kind.mixture;
+
+            values.clear();
+            rows.clear();
+            for (size_t r = 0; r < row_count; ++r) {
+                ProductValue::Diff & diff = partial_diffs[r][k];
+                cross_cat.splitter.schema(k).normalize_small(diff);
+                if (diff.tares_size()) {
+                    mixture.score_diff(model, diff, diff_scores, rng);
+                    latent_scores[r][l] +=
+                        distributions::log_sum_exp(diff_scores);
+                } else if (diff.pos().observed().sparsity() != NONE) {
+                    values.push_back(& diff.pos());
+                    rows.push_back(r);
+                }
+            }
+
+            mixture.score_values(model, values, scores, rng);
+            for (size_t i = 0; i < rows.size(); ++i) {
+                latent_scores[rows[i]][l] +=
+                    distributions::log_sum_exp(scores[i]);
+            }
+        }
+    }
+
+    scores_out.resize(row_count);
+    for (size_t r = 0; r < row_count; ++r) {
+        scores_out[r] = distributions::log_sum_exp(latent_scores[r])
+                      - distributions::fast_log(latent_count);
+    }
+}
+
 // not threadsafe
 void QueryServer::call (
         rng_t & rng,
@@ -448,12 +996,9 @@ void QueryServer::call (
         Query::ScoreDerivative::Response & response) const
 {
     const size_t latent_count = cross_cats_.size();
-
-    Query::Score::Request score_request;
-    Query::Score::Response score_response;
+    const size_t batch_size = 256;
 
     protobuf::Assignment assignment;
-    protobuf::Row row;
 
     std::vector<protobuf::Assignment> assignments;
     std::vector<CatKernel *> cat_kernels;
@@ -462,13 +1007,9 @@ void QueryServer::call (
     update_row.set_id(0);
     * update_row.mutable_diff() = request.update_data();
 
-
-    //FIXME is there a better way to get the row count?
-    size_t row_count = 0;
-    protobuf::InFile all_rows(rows_in_);
-    while (all_rows.try_read_stream(row)) {
-        row_count++;
-    }
+    // this reads the index sidecar when present, rather than every row
+    const size_t row_count =
+        protobuf::InFile::stream_stats(rows_in_).message_count;
 
     for (const auto * cross_cat : cross_cats_) {
         cat_kernels.push_back(
@@ -478,54 +1019,61 @@ void QueryServer::call (
         assignments.push_back(assignment);
     }
 
-    typedef std::pair<int, float> ScoreDiff;
-    std::vector<ScoreDiff> score_diffs;
-
-    {
+    // scores all rows, or all request.score_data, in batches
+    std::vector<protobuf::Row> rows(batch_size);
+    std::vector<const ProductValue::Diff *> batch;
+    VectorFloat batch_scores;
+    auto score_all = [&](std::vector<float> & scores, std::vector<int> & ids){
+        scores.clear();
+        ids.clear();
+        auto flush = [&](){
+            score_batch(rng, batch, batch_scores);
+            scores.insert(
+                scores.end(),
+                batch_scores.begin(),
+                batch_scores.end());
+            batch.clear();
+        };
         if (request.score_data_size() == 0) {
             protobuf::InFile all_rows(rows_in_);
-            while (all_rows.try_read_stream(row)) {
-                * score_request.mutable_data() = row.diff();
-                call(rng, score_request, score_response);
-                score_diffs.push_back(
-                    std::make_pair(row.id(), -score_response.score()));
+            while (all_rows.try_read_stream(rows[batch.size()])) {
+                ids.push_back(rows[batch.size()].id());
+                batch.push_back(& rows[batch.size()].diff());
+                if (batch.size() == batch_size) {
+                    flush();
+                }
             }
-        }
-        else {
-            for (size_t i = 0; i < request.score_data_size(); i++) {
-                * score_request.mutable_data() = request.score_data(i);
-                call(rng, score_request, score_response);
-                score_diffs.push_back(
-                    std::make_pair(i, -score_response.score()));
+        } else {
+            for (size_t i = 0; i < request.score_data_size(); ++i) {
+                ids.push_back(i);
+                batch.push_back(& request.score_data(i));
+                if (batch.size() == batch_size) {
+                    flush();
+                }
             }
         }
+        flush();
+    };
+
+    typedef std::pair<int, float> ScoreDiff;
+    std::vector<ScoreDiff> score_diffs;
+    std::vector<float> scores;
+    std::vector<int> ids;
+
+    score_all(scores, ids);
+    for (size_t i = 0; i < scores.size(); ++i) {
+        score_diffs.push_back(std::make_pair(ids[i], -scores[i]));
     }
 
     for (size_t i = 0; i < latent_count; ++i){
         cat_kernels[i]->add_row(rng, update_row, assignments[i]);
     }
 
-    {
-        int i = 0;
-        if (request.score_data_size() == 0) {
-            protobuf::InFile all_rows(rows_in_);
-            while (all_rows.try_read_stream(row)) {
-                * score_request.mutable_data() = row.diff();
-                call(rng, score_request, score_response);
-                score_diffs[i].second += score_response.score();
-                score_diffs[i].second *= row_count;
-                i++;
-            }
-        }
-        else {
-            for (size_t i = 0; i < request.score_data_size(); i++) {
-                * score_request.mutable_data() = request.score_data(i);
-                call(rng, score_request, score_response);
-                score_diffs[i].second += score_response.score();
-                score_diffs[i].second *= row_count;
-                i++;
-            }
-        }
+    score_all(scores, ids);
+    LOOM_ASSERT_EQ(scores.size(), score_diffs.size());
+    for (size_t i = 0; i < score_diffs.size(); ++i) {
+        score_diffs[i].second += scores[i];
+        score_diffs[i].second *= row_count;
     }
 
     for (size_t i = 0; i < latent_count; ++i) {
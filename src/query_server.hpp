@@ -28,13 +28,15 @@
 
 #pragma once
 
+#include <pthread.h>
+#include <thread>
 #include <loom/timer.hpp>
 #include <loom/cross_cat.hpp>
 
 namespace loom
 {
 
-class QueryServer
+class QueryServer : noncopyable
 {
 public:
 
@@ -47,18 +49,54 @@ public:
             const char * rows_in) :
         config_(config),
         cross_cats_(cross_cats),
-        rows_in_(rows_in)
+        rows_in_(rows_in),
+        thread_count_(
+            config.query().threads()
+                ? config.query().threads()
+                : std::max(1U, std::thread::hardware_concurrency())),
+        multiplexing_(false)
     {
         LOOM_ASSERT(not cross_cats_.empty(), "no cross cats found");
+        pthread_rwlock_init(& cross_cats_lock_, nullptr);
     }
 
+    ~QueryServer ()
+    {
+        pthread_rwlock_destroy(& cross_cats_lock_);
+    }
+
+    // With config.query.threads != 1, requests are served concurrently
+    // and responses are written in request order iff config.query.ordered.
     void serve (
             rng_t & rng,
             const char * requests_in,
             const char * responses_out);
 
+    // Listens on address, either unix:PATH or tcp:PORT on localhost,
+    // serving any number of connections on config.query.threads workers,
+    // until SIGINT or SIGTERM.
+    void serve_socket (rng_t & rng, const char * address);
+
+    static bool is_socket_address (const char * address)
+    {
+        return strncmp(address, "unix:", 5) == 0 or
+            strncmp(address, "tcp:", 4) == 0;
+    }
+
 private:
 
+    struct Task;
+
+    void serve_concurrently (
+            rng_t & rng,
+            const char * requests_in,
+            const char * responses_out);
+
+    void process (
+            rng_t & rng,
+            const Query::Request & request,
+            Query::Response & response) const;
+
     const ValueSchema schema () const { return cross_cats_[0]->schema; }
     const std::vector<ProductValue> tares () const
     {
@@ -102,9 +140,17 @@ private:
             const Query::ScoreDerivative::Request & request,
             Query::ScoreDerivative::Response & response) const;
 
+    void score_batch (
+            rng_t & rng,
+            const std::vector<const ProductValue::Diff *> & data,
+            VectorFloat & scores_out) const;
+
     const protobuf::Config config_;
     const std::vector<const CrossCat *> cross_cats_;
     const char * rows_in_;
+    const size_t thread_count_;
+    bool multiplexing_;
+    mutable pthread_rwlock_t cross_cats_lock_;
     Timer timer_;
 };
 
@@ -0,0 +1,483 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <google/protobuf/io/coded_stream.h>
+#include <loom/common.hpp>
+#include <loom/schema.pb.h>
+
+namespace loom
+{
+namespace protobuf
+{
+
+typedef ::protobuf::loom::RowChunk RowChunk;
+
+// Row chunk files hold RowChunk messages in place of Row messages,
+// and are named like rows.pbc, rows.pbc.gz or rows.pbc.zst.
+inline bool is_row_chunks (const char * filename)
+{
+    std::string name = filename;
+    for (const char * suffix : {".gz", ".zst", ".lz4"}) {
+        if (endswith(name.c_str(), suffix)) {
+            name.resize(name.size() - strlen(suffix));
+            break;
+        }
+    }
+    return endswith(name.c_str(), ".pbc");
+}
+
+//----------------------------------------------------------------------------
+// Encoding
+
+// Rows are buffered and transposed into one column per feature,
+// so that each column holds values only for rows observing it.
+// Columns are stored in groups of features, typically one per kind,
+// so that a kind's columns are contiguous within a chunk.
+class RowChunkEncoder : noncopyable
+{
+public:
+
+    typedef ::protobuf::loom::Row Row;
+    typedef ::protobuf::loom::ProductValue ProductValue;
+    typedef std::vector<std::vector<uint32_t>> Groups;
+
+    // An empty groups puts all features in a single group.
+    RowChunkEncoder (
+            size_t booleans_size,
+            size_t counts_size,
+            size_t reals_size,
+            const Groups & groups = Groups()) :
+        booleans_size_(booleans_size),
+        counts_size_(counts_size),
+        reals_size_(reals_size),
+        groups_(groups)
+    {
+        const size_t total = booleans_size + counts_size + reals_size;
+        if (groups_.empty()) {
+            groups_.resize(1);
+            for (size_t i = 0; i < total; ++i) {
+                groups_[0].push_back(i);
+            }
+        }
+        std::vector<bool> grouped(total, false);
+        for (auto & featureids : groups_) {
+            std::sort(featureids.begin(), featureids.end());
+            for (auto featureid : featureids) {
+                LOOM_ASSERT_LT(featureid, total);
+                LOOM_ASSERT(
+                    not grouped[featureid],
+                    "feature " << featureid << " is in two groups");
+                grouped[featureid] = true;
+            }
+        }
+        LOOM_ASSERT(
+            std::find(grouped.begin(), grouped.end(), false) == grouped.end(),
+            "groups do not cover all features");
+    }
+
+    size_t size () const { return rows_.size(); }
+
+    void add (const Row & row) { rows_.push_back(row); }
+
+    void encode (RowChunk & chunk)
+    {
+        chunk.Clear();
+        chunk.set_row_count(rows_.size());
+        chunk.set_booleans_size(booleans_size_);
+        chunk.set_counts_size(counts_size_);
+        chunk.set_reals_size(reals_size_);
+        for (const auto & row : rows_) {
+            chunk.add_ids(row.id());
+            chunk.add_tare_counts(row.diff().tares_size());
+            for (auto tare : row.diff().tares()) {
+                chunk.add_tares(tare);
+            }
+        }
+        for (const auto & featureids : groups_) {
+            auto & group = * chunk.add_groups();
+            for (auto featureid : featureids) {
+                group.add_featureids(featureid);
+            }
+        }
+        _encode(
+            * chunk.mutable_pos_sparsity(),
+            chunk,
+            [](RowChunk::Group & group)
+                -> RowChunk::Values & { return * group.mutable_pos(); },
+            [](const Row & row)
+                -> const ProductValue & { return row.diff().pos(); });
+        _encode(
+            * chunk.mutable_neg_sparsity(),
+            chunk,
+            [](RowChunk::Group & group)
+                -> RowChunk::Values & { return * group.mutable_neg(); },
+            [](const Row & row)
+                -> const ProductValue & { return row.diff().neg(); });
+        rows_.clear();
+    }
+
+private:
+
+    template<class Fun>
+    static void for_each_observed (
+            const ProductValue::Observed & observed,
+            size_t size,
+            const Fun & fun)
+    {
+        switch (observed.sparsity()) {
+            case ProductValue::Observed::ALL:
+                for (size_t i = 0; i < size; ++i) {
+                    fun(i);
+                }
+                break;
+
+            case ProductValue::Observed::DENSE:
+                LOOM_ASSERT_EQ(observed.dense_size(), size);
+                for (size_t i = 0; i < size; ++i) {
+                    if (observed.dense(i)) {
+                        fun(i);
+                    }
+                }
+                break;
+
+            case ProductValue::Observed::SPARSE:
+                for (size_t i : observed.sparse()) {
+                    LOOM_ASSERT_LT(i, size);
+                    fun(i);
+                }
+                break;
+
+            case ProductValue::Observed::NONE:
+                break;
+        }
+    }
+
+    template<class GetValues, class GetValue>
+    void _encode (
+            google::protobuf::RepeatedField<google::protobuf::uint32> &
+                sparsity,
+            RowChunk & chunk,
+            const GetValues & get_values,
+            const GetValue & get_value)
+    {
+        const size_t counts_begin = booleans_size_;
+        const size_t reals_begin = counts_begin + counts_size_;
+        const size_t total = reals_begin + reals_size_;
+        const size_t row_count = rows_.size();
+
+        // slots_[row * total + i] indexes feature i among row's typed values
+        slots_.assign(row_count * total, -1);
+        for (size_t r = 0; r < row_count; ++r) {
+            const ProductValue & value = get_value(rows_[r]);
+            sparsity.Add(value.observed().sparsity());
+            int32_t * slots = slots_.data() + r * total;
+            int32_t booleans = 0;
+            int32_t counts = 0;
+            int32_t reals = 0;
+            for_each_observed(value.observed(), total, [&](size_t i){
+                if (i < counts_begin) {
+                    slots[i] = booleans++;
+                } else if (i < reals_begin) {
+                    slots[i] = counts++;
+                } else {
+                    slots[i] = reals++;
+                }
+            });
+            LOOM_ASSERT(
+                booleans == value.booleans_size() and
+                counts == value.counts_size() and
+                reals == value.reals_size(),
+                "row " << rows_[r].id() << " does not match schema");
+        }
+
+        for (size_t g = 0; g < groups_.size(); ++g) {
+            RowChunk::Values & values = get_values(* chunk.mutable_groups(g));
+            for (size_t i : groups_[g]) {
+                std::string & observed = * values.add_observed();
+                observed.assign((row_count + 7) / 8, '\0');
+                for (size_t r = 0; r < row_count; ++r) {
+                    const int32_t slot = slots_[r * total + i];
+                    if (slot != -1) {
+                        observed[r / 8] |= 1 << (r % 8);
+                        const ProductValue & value = get_value(rows_[r]);
+                        if (i < counts_begin) {
+                            values.add_booleans(value.booleans(slot));
+                        } else if (i < reals_begin) {
+                            values.add_counts(value.counts(slot));
+                        } else {
+                            values.add_reals(value.reals(slot));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    const size_t booleans_size_;
+    const size_t counts_size_;
+    const size_t reals_size_;
+    Groups groups_;
+    std::vector<Row> rows_;
+    std::vector<int32_t> slots_;
+};
+
+//----------------------------------------------------------------------------
+// Decoding
+
+// Each chunk is parsed once, and its rows are then decoded one at a time
+// straight from the columns into the caller's Row, following a cursor
+// into each feature's column.
+class RowChunkDecoder : noncopyable
+{
+public:
+
+    typedef ::protobuf::loom::Row Row;
+    typedef ::protobuf::loom::ProductValue ProductValue;
+
+    RowChunkDecoder () : row_count_(0), next_(0) {}
+
+    size_t remaining () const { return row_count_ - next_; }
+
+    void clear ()
+    {
+        row_count_ = 0;
+        next_ = 0;
+    }
+
+    void skip (size_t count)
+    {
+        LOOM_ASSERT_LE(count, remaining());
+        for (size_t r = next_, end = next_ + count; r < end; ++r) {
+            _skip(pos_columns_, r);
+            _skip(neg_columns_, r);
+        }
+        next_ += count;
+    }
+
+    bool try_next (Row & row)
+    {
+        if (LOOM_LIKELY(remaining())) {
+            const size_t r = next_++;
+            row.Clear();
+            row.set_id(chunk_.ids(r));
+            auto & diff = * row.mutable_diff();
+            for (size_t t = tare_begins_[r]; t < tare_begins_[r + 1]; ++t) {
+                diff.add_tares(chunk_.tares(t));
+            }
+            _decode(pos_columns_, chunk_.pos_sparsity(r), r,
+                * diff.mutable_pos());
+            _decode(neg_columns_, chunk_.neg_sparsity(r), r,
+                * diff.mutable_neg());
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    // Raw readers need the serialized row.
+    bool try_next (const char * & data, uint32_t & message_size)
+    {
+        if (LOOM_LIKELY(try_next(row_))) {
+            buffer_.clear();
+            row_.AppendToString(& buffer_);
+            data = buffer_.data();
+            message_size = buffer_.size();
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    void decode (const char * data, size_t size)
+    {
+        bool success = chunk_.ParseFromArray(data, size);
+        LOOM_ASSERT(success, "failed to parse row chunk");
+        const size_t row_count = chunk_.row_count();
+        LOOM_ASSERT_EQ(chunk_.ids_size(), row_count);
+        LOOM_ASSERT_EQ(chunk_.tare_counts_size(), row_count);
+        LOOM_ASSERT_EQ(chunk_.pos_sparsity_size(), row_count);
+        LOOM_ASSERT_EQ(chunk_.neg_sparsity_size(), row_count);
+
+        tare_begins_.resize(row_count + 1);
+        tare_begins_[0] = 0;
+        for (size_t r = 0; r < row_count; ++r) {
+            tare_begins_[r + 1] = tare_begins_[r] + chunk_.tare_counts(r);
+        }
+        LOOM_ASSERT_EQ(tare_begins_[row_count], chunk_.tares_size());
+
+        _init_columns(pos_columns_, [](const RowChunk::Group & group)
+            -> const RowChunk::Values & { return group.pos(); });
+        _init_columns(neg_columns_, [](const RowChunk::Group & group)
+            -> const RowChunk::Values & { return group.neg(); });
+
+        row_count_ = row_count;
+        next_ = 0;
+    }
+
+    // This peeks at the leading row_count field rather than parsing.
+    static uint32_t peek_row_count (const char * data, size_t size)
+    {
+        google::protobuf::io::CodedInputStream coded(
+            reinterpret_cast<const google::protobuf::uint8 *>(data),
+            size);
+        google::protobuf::uint32 row_count;
+        if (LOOM_LIKELY(coded.ReadTag() == row_count_tag and
+                        coded.ReadVarint32(& row_count))) {
+            return row_count;
+        } else {
+            RowChunk chunk;
+            bool success = chunk.ParseFromArray(data, size);
+            LOOM_ASSERT(success, "failed to parse row chunk");
+            return chunk.row_count();
+        }
+    }
+
+private:
+
+    // Feature i's observed bitmap, its group's values,
+    // and the position of its next value among them.
+    struct Column
+    {
+        const char * observed;
+        const RowChunk::Values * values;
+        int pos;
+    };
+
+    static bool is_observed (const Column & column, size_t r)
+    {
+        return (column.observed[r / 8] >> (r % 8)) & 1;
+    }
+
+    template<class Get>
+    void _init_columns (std::vector<Column> & columns, const Get & get)
+    {
+        const size_t counts_begin = chunk_.booleans_size();
+        const size_t reals_begin = counts_begin + chunk_.counts_size();
+        const size_t total = reals_begin + chunk_.reals_size();
+        const size_t row_count = chunk_.row_count();
+        const size_t byte_count = (row_count + 7) / 8;
+
+        columns.assign(total, Column({nullptr, nullptr, 0}));
+        for (const auto & group : chunk_.groups()) {
+            const RowChunk::Values & values = get(group);
+            LOOM_ASSERT_EQ(values.observed_size(), group.featureids_size());
+            int booleans = 0;
+            int counts = 0;
+            int reals = 0;
+            for (size_t j = 0; j < group.featureids_size(); ++j) {
+                const size_t i = group.featureids(j);
+                LOOM_ASSERT_LT(i, total);
+                LOOM_ASSERT(
+                    columns[i].observed == nullptr,
+                    "feature " << i << " is in two groups");
+                const std::string & observed = values.observed(j);
+                LOOM_ASSERT_EQ(observed.size(), byte_count);
+
+                int count = 0;
+                for (size_t r = 0; r < row_count; ++r) {
+                    count += (observed[r / 8] >> (r % 8)) & 1;
+                }
+                int & pos = i < counts_begin ? booleans
+                          : i < reals_begin ? counts
+                          : reals;
+                columns[i] = Column({observed.data(), & values, pos});
+                pos += count;
+            }
+            LOOM_ASSERT_EQ(booleans, values.booleans_size());
+            LOOM_ASSERT_EQ(counts, values.counts_size());
+            LOOM_ASSERT_EQ(reals, values.reals_size());
+        }
+        for (size_t i = 0; i < total; ++i) {
+            LOOM_ASSERT(columns[i].values, "feature " << i << " is missing");
+        }
+    }
+
+    void _skip (std::vector<Column> & columns, size_t r)
+    {
+        for (auto & column : columns) {
+            column.pos += is_observed(column, r);
+        }
+    }
+
+    void _decode (
+            std::vector<Column> & columns,
+            uint32_t sparsity,
+            size_t r,
+            ProductValue & value)
+    {
+        const size_t counts_begin = chunk_.booleans_size();
+        const size_t reals_begin = counts_begin + chunk_.counts_size();
+        const size_t total = columns.size();
+
+        auto & observed = * value.mutable_observed();
+        observed.set_sparsity(
+            static_cast<ProductValue::Observed::Sparsity>(sparsity));
+        if (sparsity == ProductValue::Observed::DENSE) {
+            observed.mutable_dense()->Resize(total, false);
+        }
+        for (size_t i = 0; i < total; ++i) {
+            Column & column = columns[i];
+            if (is_observed(column, r)) {
+                if (sparsity == ProductValue::Observed::DENSE) {
+                    observed.set_dense(i, true);
+                } else if (sparsity == ProductValue::Observed::SPARSE) {
+                    observed.add_sparse(i);
+                }
+                const int pos = column.pos++;
+                if (i < counts_begin) {
+                    value.add_booleans(column.values->booleans(pos));
+                } else if (i < reals_begin) {
+                    value.add_counts(column.values->counts(pos));
+                } else {
+                    value.add_reals(column.values->reals(pos));
+                }
+            }
+        }
+    }
+
+    // field 1 (RowChunk.row_count), wire type 0 (varint)
+    enum { row_count_tag = (1 << 3) | 0 };
+
+    RowChunk chunk_;
+    std::vector<uint32_t> tare_begins_;
+    std::vector<Column> pos_columns_;
+    std::vector<Column> neg_columns_;
+    size_t row_count_;
+    size_t next_;
+    Row row_;
+    std::string buffer_;
+};
+
+} // namespace protobuf
+} // namespace loom
@@ -0,0 +1,435 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <loom/score_kernels.hpp>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  define LOOM_SCORE_KERNELS_X86 1
+#  include <immintrin.h>
+#else // defined(__x86_64__) && defined(__GNUC__)
+#  define LOOM_SCORE_KERNELS_X86 0
+#endif // defined(__x86_64__) && defined(__GNUC__)
+
+namespace loom
+{
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+// Natural log, after the cephes logf polynomial; relative error < 1e-7.
+// The scalar and vector versions compute the same approximation, so loop
+// tails agree with vector lanes.
+
+const float LOG_SQRTHF = 0.707106781186547524f;
+const float LOG_P0 = 7.0376836292e-2f;
+const float LOG_P1 = -1.1514610310e-1f;
+const float LOG_P2 = 1.1676998740e-1f;
+const float LOG_P3 = -1.2420140846e-1f;
+const float LOG_P4 = 1.4249322787e-1f;
+const float LOG_P5 = -1.6668057665e-1f;
+const float LOG_P6 = 2.0000714765e-1f;
+const float LOG_P7 = -2.4999993993e-1f;
+const float LOG_P8 = 3.3333331174e-1f;
+const float LOG_Q1 = -2.12194440e-4f;
+const float LOG_Q2 = 0.693359375f;
+
+// valid for finite x > 0
+inline float log_scalar (float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float e = static_cast<float>(static_cast<int>(bits >> 23) - 126);
+    bits = (bits & 0x007fffffu) | 0x3f000000u;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    if (m < LOG_SQRTHF) {
+        e -= 1.f;
+        m = m + m - 1.f;
+    } else {
+        m = m - 1.f;
+    }
+    const float z = m * m;
+    float p = LOG_P0;
+    p = p * m + LOG_P1;
+    p = p * m + LOG_P2;
+    p = p * m + LOG_P3;
+    p = p * m + LOG_P4;
+    p = p * m + LOG_P5;
+    p = p * m + LOG_P6;
+    p = p * m + LOG_P7;
+    p = p * m + LOG_P8;
+    float y = p * m * z;
+    y += e * LOG_Q1;
+    y -= 0.5f * z;
+    return m + y + e * LOG_Q2;
+}
+
+//----------------------------------------------------------------------------
+// Scalar loops, also used for tails of the vector loops
+
+inline void score_add_scalar (
+        size_t begin,
+        size_t end,
+        float * scores,
+        const float * column)
+{
+    for (size_t g = begin; g < end; ++g) {
+        scores[g] += column[g];
+    }
+}
+
+inline void score_add_shifted_scalar (
+        size_t begin,
+        size_t end,
+        float * scores,
+        const float * column,
+        const float * shift)
+{
+    for (size_t g = begin; g < end; ++g) {
+        scores[g] += column[g] - shift[g];
+    }
+}
+
+inline void score_add_student_t_scalar (
+        size_t begin,
+        size_t end,
+        float * scores,
+        float x,
+        const float * mu,
+        const float * scale,
+        const float * coeff,
+        const float * power)
+{
+    for (size_t g = begin; g < end; ++g) {
+        const float delta = x - mu[g];
+        const float arg = 1.f + scale[g] * delta * delta;
+        scores[g] += coeff[g] - power[g] * log_scalar(arg);
+    }
+}
+
+void score_add_generic (size_t size, float * scores, const float * column)
+{
+    score_add_scalar(0, size, scores, column);
+}
+
+void score_add_shifted_generic (
+        size_t size,
+        float * scores,
+        const float * column,
+        const float * shift)
+{
+    score_add_shifted_scalar(0, size, scores, column, shift);
+}
+
+void score_add_student_t_generic (
+        size_t size,
+        float * scores,
+        float x,
+        const float * mu,
+        const float * scale,
+        const float * coeff,
+        const float * power)
+{
+    score_add_student_t_scalar(0, size, scores, x, mu, scale, coeff, power);
+}
+
+#if LOOM_SCORE_KERNELS_X86
+
+//----------------------------------------------------------------------------
+// AVX2 loops
+
+#define LOOM_AVX2 __attribute__((target("avx2,fma")))
+
+LOOM_AVX2 inline __m256 log_avx2 (__m256 x)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+        _mm256_srli_epi32(bits, 23),
+        _mm256_set1_epi32(126)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+        _mm256_set1_epi32(0x3f000000)));
+    const __m256 small = _mm256_cmp_ps(
+        m,
+        _mm256_set1_ps(LOG_SQRTHF),
+        _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(small, one));
+    m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(small, m)), one);
+    const __m256 z = _mm256_mul_ps(m, m);
+    __m256 p = _mm256_set1_ps(LOG_P0);
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P1));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P2));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P3));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P4));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P5));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P6));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P7));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(LOG_P8));
+    __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, m), z);
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(LOG_Q1), y);
+    y = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, y);
+    return _mm256_fmadd_ps(e, _mm256_set1_ps(LOG_Q2), _mm256_add_ps(m, y));
+}
+
+LOOM_AVX2 void score_add_avx2 (
+        size_t size,
+        float * scores,
+        const float * column)
+{
+    size_t g = 0;
+    for (; g + 8 <= size; g += 8) {
+        _mm256_storeu_ps(scores + g, _mm256_add_ps(
+            _mm256_loadu_ps(scores + g),
+            _mm256_loadu_ps(column + g)));
+    }
+    score_add_scalar(g, size, scores, column);
+}
+
+LOOM_AVX2 void score_add_shifted_avx2 (
+        size_t size,
+        float * scores,
+        const float * column,
+        const float * shift)
+{
+    size_t g = 0;
+    for (; g + 8 <= size; g += 8) {
+        const __m256 diff = _mm256_sub_ps(
+            _mm256_loadu_ps(column + g),
+            _mm256_loadu_ps(shift + g));
+        _mm256_storeu_ps(
+            scores + g,
+            _mm256_add_ps(_mm256_loadu_ps(scores + g), diff));
+    }
+    score_add_shifted_scalar(g, size, scores, column, shift);
+}
+
+LOOM_AVX2 void score_add_student_t_avx2 (
+        size_t size,
+        float * scores,
+        float x,
+        const float * mu,
+        const float * scale,
+        const float * coeff,
+        const float * power)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 xs = _mm256_set1_ps(x);
+    size_t g = 0;
+    for (; g + 8 <= size; g += 8) {
+        const __m256 delta = _mm256_sub_ps(xs, _mm256_loadu_ps(mu + g));
+        const __m256 arg = _mm256_fmadd_ps(
+            _mm256_loadu_ps(scale + g),
+            _mm256_mul_ps(delta, delta),
+            one);
+        const __m256 score = _mm256_fnmadd_ps(
+            _mm256_loadu_ps(power + g),
+            log_avx2(arg),
+            _mm256_loadu_ps(coeff + g));
+        _mm256_storeu_ps(
+            scores + g,
+            _mm256_add_ps(_mm256_loadu_ps(scores + g), score));
+    }
+    score_add_student_t_scalar(g, size, scores, x, mu, scale, coeff, power);
+}
+
+#undef LOOM_AVX2
+
+//----------------------------------------------------------------------------
+// AVX-512 loops
+
+#define LOOM_AVX512 __attribute__((target("avx512f")))
+
+LOOM_AVX512 inline __m512 log_avx512 (__m512 x)
+{
+    const __m512 one = _mm512_set1_ps(1.f);
+    const __m512i bits = _mm512_castps_si512(x);
+    __m512 e = _mm512_cvtepi32_ps(_mm512_sub_epi32(
+        _mm512_srli_epi32(bits, 23),
+        _mm512_set1_epi32(126)));
+    __m512 m = _mm512_castsi512_ps(_mm512_or_si512(
+        _mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)),
+        _mm512_set1_epi32(0x3f000000)));
+    const __mmask16 small = _mm512_cmp_ps_mask(
+        m,
+        _mm512_set1_ps(LOG_SQRTHF),
+        _CMP_LT_OQ);
+    e = _mm512_mask_sub_ps(e, small, e, one);
+    m = _mm512_sub_ps(_mm512_mask_add_ps(m, small, m, m), one);
+    const __m512 z = _mm512_mul_ps(m, m);
+    __m512 p = _mm512_set1_ps(LOG_P0);
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P1));
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P2));
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P3));
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P4));
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P5));
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P6));
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P7));
+    p = _mm512_fmadd_ps(p, m, _mm512_set1_ps(LOG_P8));
+    __m512 y = _mm512_mul_ps(_mm512_mul_ps(p, m), z);
+    y = _mm512_fmadd_ps(e, _mm512_set1_ps(LOG_Q1), y);
+    y = _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, y);
+    return _mm512_fmadd_ps(e, _mm512_set1_ps(LOG_Q2), _mm512_add_ps(m, y));
+}
+
+LOOM_AVX512 void score_add_avx512 (
+        size_t size,
+        float * scores,
+        const float * column)
+{
+    size_t g = 0;
+    for (; g + 16 <= size; g += 16) {
+        _mm512_storeu_ps(scores + g, _mm512_add_ps(
+            _mm512_loadu_ps(scores + g),
+            _mm512_loadu_ps(column + g)));
+    }
+    score_add_scalar(g, size, scores, column);
+}
+
+LOOM_AVX512 void score_add_shifted_avx512 (
+        size_t size,
+        float * scores,
+        const float * column,
+        const float * shift)
+{
+    size_t g = 0;
+    for (; g + 16 <= size; g += 16) {
+        const __m512 diff = _mm512_sub_ps(
+            _mm512_loadu_ps(column + g),
+            _mm512_loadu_ps(shift + g));
+        _mm512_storeu_ps(
+            scores + g,
+            _mm512_add_ps(_mm512_loadu_ps(scores + g), diff));
+    }
+    score_add_shifted_scalar(g, size, scores, column, shift);
+}
+
+LOOM_AVX512 void score_add_student_t_avx512 (
+        size_t size,
+        float * scores,
+        float x,
+        const float * mu,
+        const float * scale,
+        const float * coeff,
+        const float * power)
+{
+    const __m512 one = _mm512_set1_ps(1.f);
+    const __m512 xs = _mm512_set1_ps(x);
+    size_t g = 0;
+    for (; g + 16 <= size; g += 16) {
+        const __m512 delta = _mm512_sub_ps(xs, _mm512_loadu_ps(mu + g));
+        const __m512 arg = _mm512_fmadd_ps(
+            _mm512_loadu_ps(scale + g),
+            _mm512_mul_ps(delta, delta),
+            one);
+        const __m512 score = _mm512_fnmadd_ps(
+            _mm512_loadu_ps(power + g),
+            log_avx512(arg),
+            _mm512_loadu_ps(coeff + g));
+        _mm512_storeu_ps(
+            scores + g,
+            _mm512_add_ps(_mm512_loadu_ps(scores + g), score));
+    }
+    score_add_student_t_scalar(g, size, scores, x, mu, scale, coeff, power);
+}
+
+#undef LOOM_AVX512
+
+#endif // LOOM_SCORE_KERNELS_X86
+
+//----------------------------------------------------------------------------
+// Dispatch
+
+struct ScoreKernels
+{
+    decltype(&score_add_generic) add;
+    decltype(&score_add_shifted_generic) add_shifted;
+    decltype(&score_add_student_t_generic) add_student_t;
+
+    ScoreKernels () :
+        add(score_add_generic),
+        add_shifted(score_add_shifted_generic),
+        add_student_t(score_add_student_t_generic)
+    {
+#if LOOM_SCORE_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            add = score_add_avx512;
+            add_shifted = score_add_shifted_avx512;
+            add_student_t = score_add_student_t_avx512;
+        } else if (
+            __builtin_cpu_supports("avx2") and
+            __builtin_cpu_supports("fma"))
+        {
+            add = score_add_avx2;
+            add_shifted = score_add_shifted_avx2;
+            add_student_t = score_add_student_t_avx2;
+        }
+#endif // LOOM_SCORE_KERNELS_X86
+    }
+};
+
+inline const ScoreKernels & score_kernels ()
+{
+    static const ScoreKernels kernels;
+    return kernels;
+}
+
+} // anonymous namespace
+
+void score_add (size_t size, float * scores, const float * column)
+{
+    score_kernels().add(size, scores, column);
+}
+
+void score_add_shifted (
+        size_t size,
+        float * scores,
+        const float * column,
+        const float * shift)
+{
+    score_kernels().add_shifted(size, scores, column, shift);
+}
+
+void score_add_student_t (
+        size_t size,
+        float * scores,
+        float x,
+        const float * mu,
+        const float * scale,
+        const float * coeff,
+        const float * power)
+{
+    score_kernels().add_student_t(size, scores, x, mu, scale, coeff, power);
+}
+
+} // namespace loom
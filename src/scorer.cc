@@ -26,6 +26,8 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
+#include <numeric>
 #include <loom/scorer.hpp>
 
 namespace loom
@@ -40,7 +42,14 @@ RestrictionScorerKind::RestrictionScorerKind (
     likelihoods_(kind.model.schema.total_size()),
     restriction_to_hash_(),
     pos_to_hash_(),
-    hash_to_score_()
+    hash_to_score_(),
+    features_(),
+    hash_to_features_(1, 0),
+    node_depth_(),
+    node_feature_(),
+    node_to_hashes_(),
+    node_hashes_(),
+    path_scores_()
 {
     kind.mixture.score_diff(kind.model, conditional, prior_, rng);
 }
@@ -59,6 +68,18 @@ inline void RestrictionScorerKind::add_restriction (
     if (LOOM_UNLIKELY(inserted.second)) {
         hash = hash_to_score_.size();
         hash_to_score_.push_back(NAN);
+
+        // compile once, so that set_value never touches protobuf
+        if (LOOM_DEBUG_LEVEL >= 1) {
+            kind_.model.schema.validate(restriction);
+        }
+        kind_.model.schema.for_each(restriction, [&](size_t i){
+            if (LOOM_DEBUG_LEVEL >= 1) {
+                LOOM_ASSERT_LT(i, likelihoods_.size());
+            }
+            features_.push_back(i);
+        });
+        hash_to_features_.push_back(features_.size());
     }
     pos_to_hash_.push_back(hash);
 
@@ -88,36 +109,139 @@ inline void RestrictionScorerKind::set_value (
         *feature_scores,
         rng);
 
-    for (const auto & pair : restriction_to_hash_) {
-        hash_to_score_[pair.second] = _compute_score(pair.first);
+    if (LOOM_UNLIKELY(
+            node_depth_.empty() or
+            node_hashes_.size() != hash_to_score_.size()))
+    {
+        _build_plan();
+    }
+
+    // each shared partial sum is computed once, walking the tree depth
+    // first so that only the current path's sums are live
+    path_scores_[0] = prior_;
+    const uint32_t node_count = node_depth_.size();
+    for (uint32_t node = 0; node < node_count; ++node) {
+        const uint32_t depth = node_depth_[node];
+        VectorFloat & scores = path_scores_[depth];
+        if (node) {
+            const VectorFloat & likelihoods =
+                likelihoods_[node_feature_[node]];
+            scores = path_scores_[depth - 1];
+            if (LOOM_DEBUG_LEVEL >= 1) {
+                LOOM_ASSERT_EQ(likelihoods.size(), scores.size());
+            }
+            distributions::vector_add(
+                    scores.size(),
+                    scores.data(),
+                    likelihoods.data());
+        }
+
+        const uint32_t begin = node_to_hashes_[node];
+        const uint32_t end = node_to_hashes_[node + 1];
+        if (begin != end) {
+            const float score = distributions::log_sum_exp(scores);
+            for (uint32_t i = begin; i < end; ++i) {
+                hash_to_score_[node_hashes_[i]] = score;
+            }
+        }
     }
 }
 
-inline float RestrictionScorerKind::_compute_score (
-        const std::string & message) const
+void RestrictionScorerKind::_build_plan ()
 {
-    // never freed
-    static thread_local ProductValue::Observed * restriction = nullptr;
-    static thread_local VectorFloat * scores = nullptr;
-    construct_if_null(restriction);
-    construct_if_null(scores);
+    const uint32_t hash_count = hash_to_score_.size();
 
-    restriction->ParseFromString(message);
-    if (LOOM_DEBUG_LEVEL >= 1) {
-        kind_.model.schema.validate(*restriction);
+    // features shared by more restrictions go nearer the root
+    std::vector<uint32_t> counts(likelihoods_.size(), 0);
+    for (uint32_t feature : features_) {
+        ++counts[feature];
     }
-    *scores = prior_;
-    kind_.model.schema.for_each(*restriction, [&](size_t i){
-        if (LOOM_DEBUG_LEVEL >= 1) {
-            LOOM_ASSERT_LT(i, likelihoods_.size());
-            LOOM_ASSERT_EQ(likelihoods_[i].size(), scores->size());
+    auto more_shared = [&](uint32_t lhs, uint32_t rhs){
+        return counts[lhs] > counts[rhs] or
+            (counts[lhs] == counts[rhs] and lhs < rhs);
+    };
+
+    // build the tree in insertion order, keying children by
+    // (parent node, feature); parents precede their children
+    std::unordered_map<uint64_t, uint32_t> children;
+    std::vector<uint32_t> sorted;
+    std::vector<uint32_t> parents(1, 0);
+    std::vector<uint32_t> features(1, 0);
+    std::vector<uint32_t> hash_to_node(hash_count);
+    for (uint32_t hash = 0; hash < hash_count; ++hash) {
+        sorted.assign(
+            features_.begin() + hash_to_features_[hash],
+            features_.begin() + hash_to_features_[hash + 1]);
+        std::sort(sorted.begin(), sorted.end(), more_shared);
+
+        uint32_t node = 0;
+        for (uint32_t feature : sorted) {
+            const uint64_t key = (uint64_t(node) << 32) | feature;
+            auto inserted = children.insert(
+                std::make_pair(key, uint32_t(parents.size())));
+            if (inserted.second) {
+                parents.push_back(node);
+                features.push_back(feature);
+            }
+            node = inserted.first->second;
         }
-        distributions::vector_add(
-                scores->size(),
-                scores->data(),
-                likelihoods_[i].data());
-    });
-    return distributions::log_sum_exp(*scores);
+        hash_to_node[hash] = node;
+    }
+    const uint32_t node_count = parents.size();
+
+    // child lists, in the same layout as node_to_hashes_
+    std::vector<uint32_t> child_begin(node_count + 1, 0);
+    for (uint32_t node = 1; node < node_count; ++node) {
+        ++child_begin[parents[node] + 1];
+    }
+    std::partial_sum(child_begin.begin(), child_begin.end(),
+        child_begin.begin());
+    std::vector<uint32_t> child_nodes(node_count);
+    {
+        std::vector<uint32_t> pos(child_begin.begin(), child_begin.end() - 1);
+        for (uint32_t node = 1; node < node_count; ++node) {
+            child_nodes[pos[parents[node]]++] = node;
+        }
+    }
+
+    // renumber nodes in depth-first order
+    std::vector<uint32_t> renumbered(node_count);
+    std::vector<uint32_t> depths(node_count, 0);
+    std::vector<uint32_t> stack(1, 0);
+    node_depth_.clear();
+    node_feature_.clear();
+    uint32_t max_depth = 0;
+    while (not stack.empty()) {
+        const uint32_t node = stack.back();
+        stack.pop_back();
+        renumbered[node] = node_depth_.size();
+        node_depth_.push_back(depths[node]);
+        node_feature_.push_back(features[node]);
+        max_depth = std::max(max_depth, depths[node]);
+        for (uint32_t i = child_begin[node + 1]; i > child_begin[node];) {
+            const uint32_t child = child_nodes[--i];
+            depths[child] = depths[node] + 1;
+            stack.push_back(child);
+        }
+    }
+
+    node_to_hashes_.assign(node_count + 1, 0);
+    for (uint32_t hash = 0; hash < hash_count; ++hash) {
+        ++node_to_hashes_[renumbered[hash_to_node[hash]] + 1];
+    }
+    std::partial_sum(node_to_hashes_.begin(), node_to_hashes_.end(),
+        node_to_hashes_.begin());
+    node_hashes_.resize(hash_count);
+    {
+        std::vector<uint32_t> pos(
+            node_to_hashes_.begin(),
+            node_to_hashes_.end() - 1);
+        for (uint32_t hash = 0; hash < hash_count; ++hash) {
+            node_hashes_[pos[renumbered[hash_to_node[hash]]]++] = hash;
+        }
+    }
+
+    path_scores_.resize(max_depth + 1);
 }
 
 RestrictionScorer::RestrictionScorer (
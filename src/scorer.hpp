@@ -45,6 +45,26 @@ class RestrictionScorerKind
     std::vector<uint32_t> pos_to_hash_;
     std::vector<float> hash_to_score_;
 
+    // restriction hash's featureids are features_[begin:end]
+    // where begin,end = hash_to_features_[hash], hash_to_features_[hash+1]
+    std::vector<uint32_t> features_;
+    std::vector<uint32_t> hash_to_features_;
+
+    // Restrictions share sub-sums, so their feature lists are merged into
+    // a prefix tree, most frequent features first. Nodes are stored in
+    // depth-first order; node 0 is the prior, and each other node adds one
+    // feature's likelihoods to the nearest preceding node one level up.
+    // Node n ends restrictions node_hashes_[begin:end]
+    // where begin,end = node_to_hashes_[n], node_to_hashes_[n+1].
+    // Rebuilt when restrictions are added.
+    std::vector<uint32_t> node_depth_;
+    std::vector<uint32_t> node_feature_;
+    std::vector<uint32_t> node_to_hashes_;
+    std::vector<uint32_t> node_hashes_;
+
+    // partial sums along the current path, one per depth
+    std::vector<VectorFloat> path_scores_;
+
 public:
 
     RestrictionScorerKind (
@@ -67,7 +87,7 @@ public:
 
 private:
 
-    float _compute_score (const std::string & message) const;
+    void _build_plan ();
 };
 
 class RestrictionScorer : noncopyable
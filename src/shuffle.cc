@@ -26,16 +26,19 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <thread>
 #include <loom/args.hpp>
 #include <loom/shuffle.hpp>
 
 const char * help_message =
 "Usage: shuffle ROWS_IN ROWS_OUT [SEED=0] [TARGET_MEM_BYTES=4e9]"
+"\n       [THREADS=0]"
 "\nArguments:"
 "\n  ROWS_IN           filename of input dataset stream (e.g. rows.pbs.gz)"
 "\n  ROWS_OUT          filename of output dataset stream (e.g. rows_out.pbs.gz)"
 "\n  SEED              random seed"
 "\n  TARGET_MEM_BYTES  target memory usage in bytes"
+"\n  THREADS           number of threads, or 0 to use all cores"
 "\nNotes:"
 "\n  Any filename can end with .gz to indicate gzip compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
@@ -50,11 +53,21 @@ int main (int argc, char ** argv)
     const char * rows_out = args.pop();
     const long seed = args.pop_default(0L);
     const double target_mem_bytes = args.pop_default(4e9);
+    const int threads = args.pop_default(0);
     args.done();
 
     LOOM_ASSERT_LT(0, target_mem_bytes);
+    LOOM_ASSERT_LE(0, threads);
+    const size_t thread_count = threads
+        ? threads
+        : std::max(1U, std::thread::hardware_concurrency());
 
-    loom::shuffle_stream(rows_in, rows_out, seed, target_mem_bytes);
+    loom::shuffle_stream(
+        rows_in,
+        rows_out,
+        seed,
+        target_mem_bytes,
+        thread_count);
 
     return 0;
 }
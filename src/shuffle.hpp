@@ -28,60 +28,420 @@
 
 #pragma once
 
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cmath>
 #include <limits>
 #include <algorithm>
+#include <mutex>
 #include <loom/common.hpp>
 #include <loom/protobuf_stream.hpp>
 
+// Shuffled order sorts messages by a pseudorandom key of (seed, position),
+// breaking ties by position.  One pass scatters messages into temporary
+// bucket files by key range, then each bucket is sorted in memory and
+// appended to the output.  A bucket that is still too large for memory is
+// scattered again over its own key range, so no input is too large.
+// The order depends on the seed but not on target_mem_bytes, which only
+// determines the number and depth of buckets.
+
 namespace loom
 {
 
+namespace shuffle
+{
+
+typedef std::vector<char> Message;
+
+// buckets per scatter level, bounding open files and write buffers
+enum { max_bucket_count = 512 };
+
+inline uint64_t mix (uint64_t z)
+{
+    // splitmix64 finalizer
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t get_key (uint64_t seed, uint64_t pos)
+{
+    return mix(mix(seed) + (pos + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+struct Entry
+{
+    uint64_t key;
+    uint64_t pos;
+    Message message;
+
+    bool operator< (const Entry & other) const
+    {
+        return key < other.key or (key == other.key and pos < other.pos);
+    }
+};
+
+// Buckets are stored as streams of messages, each suffixed by its position.
+// Each scatter thread buffers records per bucket and appends whole buffers.
+class BucketFile : noncopyable
+{
+public:
+
+    BucketFile () : fid_(-1), record_count_(0), byte_count_(0) {}
+
+    ~BucketFile ()
+    {
+        if (fid_ != -1) {
+            close(fid_);
+        }
+    }
+
+    const std::string & path () const { return path_; }
+    uint64_t record_count () const { return record_count_; }
+
+    // estimated memory needed to sort this bucket
+    double mem_bytes () const
+    {
+        return record_count_ * double(sizeof(Entry)) + byte_count_;
+    }
+
+    void open (const std::string & path)
+    {
+        path_ = path;
+        fid_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        LOOM_ASSERT(fid_ != -1, "failed to open bucket file " << path);
+    }
+
+    static void append_record (
+            std::vector<char> & buffer,
+            const Message & message,
+            uint64_t pos)
+    {
+        const uint32_t record_size = message.size() + sizeof(pos);
+        const size_t begin = buffer.size();
+        buffer.resize(begin + sizeof(record_size) + record_size);
+        auto * header = reinterpret_cast<google::protobuf::uint8 *>(
+            buffer.data() + begin);
+        google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(
+            record_size,
+            header);
+        char * data = buffer.data() + begin + sizeof(record_size);
+        memcpy(data, message.data(), message.size());
+        memcpy(data + message.size(), & pos, sizeof(pos));
+    }
+
+    void write (std::vector<char> & buffer, uint64_t & record_count)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        record_count_ += record_count;
+        byte_count_ += buffer.size();
+        record_count = 0;
+        const char * data = buffer.data();
+        size_t size = buffer.size();
+        while (size) {
+            ssize_t count = ::write(fid_, data, size);
+            LOOM_ASSERT(count > 0, "failed to write bucket file " << path_);
+            data += count;
+            size -= count;
+        }
+        buffer.clear();
+    }
+
+    void close_file ()
+    {
+        if (fid_ != -1) {
+            close(fid_);
+            fid_ = -1;
+        }
+    }
+
+private:
+
+    std::string path_;
+    int fid_;
+    uint64_t record_count_;
+    uint64_t byte_count_;
+    std::mutex mutex_;
+};
+
+inline uint64_t pop_pos (Message & message)
+{
+    LOOM_ASSERT_LE(sizeof(uint64_t), message.size());
+    uint64_t pos;
+    memcpy(& pos, message.data() + message.size() - sizeof(pos), sizeof(pos));
+    message.resize(message.size() - sizeof(pos));
+    return pos;
+}
+
+// This partitions entries into key ranges, one per thread,
+// and sorts each range in parallel.
+inline void parallel_sort (std::vector<Entry> & entries, size_t thread_count)
+{
+    if (thread_count <= 1 or entries.size() < 1024 * thread_count) {
+        std::sort(entries.begin(), entries.end());
+        return;
+    }
+
+    uint64_t min_key = std::numeric_limits<uint64_t>::max();
+    uint64_t max_key = 0;
+    for (const auto & entry : entries) {
+        min_key = std::min(min_key, entry.key);
+        max_key = std::max(max_key, entry.key);
+    }
+    const uint64_t part_width = (max_key - min_key) / thread_count + 1;
+
+    std::vector<size_t> offsets(thread_count + 1, 0);
+    for (const auto & entry : entries) {
+        ++offsets[(entry.key - min_key) / part_width + 1];
+    }
+    for (size_t p = 0; p < thread_count; ++p) {
+        offsets[p + 1] += offsets[p];
+    }
+    std::vector<Entry> parts(entries.size());
+    std::vector<size_t> ends(offsets.begin(), offsets.end() - 1);
+    for (auto & entry : entries) {
+        std::swap(parts[ends[(entry.key - min_key) / part_width]++], entry);
+    }
+
+    #pragma omp parallel for num_threads(thread_count) schedule(dynamic, 1)
+    for (size_t p = 0; p < thread_count; ++p) {
+        std::sort(parts.begin() + offsets[p], parts.begin() + offsets[p + 1]);
+    }
+    entries.swap(parts);
+}
+
+inline void sort_and_write (
+        std::vector<Entry> & entries,
+        protobuf::OutFile & shuffled,
+        size_t thread_count)
+{
+    parallel_sort(entries, thread_count);
+    for (const auto & entry : entries) {
+        shuffled.write_stream(entry.message.data(), entry.message.size());
+    }
+    entries.clear();
+}
+
+inline size_t get_bucket_count (
+        double mem_bytes,
+        uint64_t record_count,
+        double target_mem_bytes)
+{
+    const double bucket_count = std::min(
+        std::min(double(max_bucket_count), double(record_count)),
+        std::ceil(mem_bytes / target_mem_bytes));
+    return static_cast<size_t>(std::max(1.0, bucket_count));
+}
+
+// Buckets cover consecutive key ranges [begin + b * width, ...).
+// A bucket that fits in memory is sorted and written; a larger one is
+// scattered into sub-buckets over its key range, recursively.
+inline void gather_bucket (
+        BucketFile & bucket,
+        uint64_t key_begin,
+        uint64_t key_width,
+        long seed,
+        double target_mem_bytes,
+        protobuf::OutFile & shuffled,
+        size_t thread_count)
+{
+    bucket.close_file();
+    Message message;
+
+    const size_t bucket_count = get_bucket_count(
+        bucket.mem_bytes(),
+        bucket.record_count(),
+        target_mem_bytes);
+    if (bucket_count == 1 or key_width <= 1) {
+        std::vector<Entry> entries;
+        entries.reserve(bucket.record_count());
+        {
+            protobuf::InFile file(
+                bucket.path().c_str(),
+                protobuf::InFile::MMAP);
+            while (file.try_read_stream(message)) {
+                entries.push_back(Entry());
+                Entry & entry = entries.back();
+                entry.pos = pop_pos(message);
+                entry.key = get_key(seed, entry.pos);
+                std::swap(entry.message, message);
+            }
+        }
+        unlink(bucket.path().c_str());
+        sort_and_write(entries, shuffled, thread_count);
+        return;
+    }
+
+    const uint64_t bucket_width = (key_width - 1) / bucket_count + 1;
+    std::vector<BucketFile> buckets(bucket_count);
+    for (size_t b = 0; b < bucket_count; ++b) {
+        buckets[b].open(bucket.path() + "." + std::to_string(b));
+    }
+    const size_t buffer_bytes = std::max(
+        4096.0,
+        target_mem_bytes / (2.0 * bucket_count));
+    std::vector<std::vector<char>> buffers(bucket_count);
+    std::vector<uint64_t> counts(bucket_count, 0);
+    {
+        protobuf::InFile file(bucket.path().c_str(), protobuf::InFile::MMAP);
+        while (file.try_read_stream(message)) {
+            const uint64_t pos = pop_pos(message);
+            const size_t b = (get_key(seed, pos) - key_begin) / bucket_width;
+            LOOM_ASSERT2(b < bucket_count, "key out of bucket range");
+            BucketFile::append_record(buffers[b], message, pos);
+            ++counts[b];
+            if (buffers[b].size() >= buffer_bytes) {
+                buckets[b].write(buffers[b], counts[b]);
+            }
+        }
+    }
+    unlink(bucket.path().c_str());
+    for (size_t b = 0; b < bucket_count; ++b) {
+        buckets[b].write(buffers[b], counts[b]);
+        buckets[b].close_file();
+    }
+    std::vector<std::vector<char>>().swap(buffers);
+
+    for (size_t b = 0; b < bucket_count; ++b) {
+        gather_bucket(
+            buckets[b],
+            key_begin + b * bucket_width,
+            bucket_width,
+            seed,
+            target_mem_bytes,
+            shuffled,
+            thread_count);
+    }
+}
+
+inline std::string make_temp_dir (const char * shuffled_out)
+{
+    std::string dirname;
+    if (protobuf::is_std_stream(shuffled_out)) {
+        const char * tmpdir = getenv("TMPDIR");
+        dirname = tmpdir ? tmpdir : "/tmp";
+    } else {
+        dirname = shuffled_out;
+        const size_t slash = dirname.rfind('/');
+        dirname = (slash == std::string::npos) ? "." : dirname.substr(0, slash);
+    }
+    std::string path = dirname + "/loom_shuffle.XXXXXX";
+    bool success = mkdtemp(& path[0]);
+    LOOM_ASSERT(success, "failed to create temp dir " << path);
+    return path;
+}
+
+} // namespace shuffle
+
 inline void shuffle_stream (
         const char * messages_in,
         const char * shuffled_out,
         long seed,
-        double target_mem_bytes)
+        double target_mem_bytes,
+        size_t thread_count = 1)
 {
-    typedef std::vector<char> Message;
-    typedef uint32_t pos_t;
+    using namespace shuffle;
 
     LOOM_ASSERT(
         std::string(messages_in) != std::string(shuffled_out),
         "cannot shuffle file in-place: " << messages_in);
-    const auto stats = protobuf::InFile::stream_stats(messages_in);
+    LOOM_ASSERT_LT(0, thread_count);
+    protobuf::StreamIndex index;
+    const auto stats = protobuf::InFile::stream_stats(messages_in, & index);
     LOOM_ASSERT(stats.is_file, "shuffle input is not a file: " << messages_in);
-    const uint64_t max_message_count = std::numeric_limits<pos_t>::max();
-    LOOM_ASSERT(stats.message_count, max_message_count);
-    const size_t message_count = stats.message_count;
+    const uint64_t message_count = stats.message_count;
 
-    double index_bytes = sizeof(pos_t) * message_count;
-    double target_chunk_size = std::max(1.0, std::min(double(message_count),
-        (target_mem_bytes - index_bytes) / stats.max_message_size));
-    size_t chunk_size = static_cast<size_t>(std::round(target_chunk_size));
+    const double entry_bytes = sizeof(Entry) + stats.max_message_size;
+    const size_t bucket_count = get_bucket_count(
+        message_count * entry_bytes,
+        message_count,
+        target_mem_bytes);
 
-    std::vector<pos_t> index(message_count);
-    for (size_t i = 0; i < message_count; ++i) {
-        index[i] = i;
+    protobuf::OutFile shuffled(
+        shuffled_out,
+        protobuf::OutFile::INDEXED | protobuf::OutFile::BLOCK_GZIP);
+    std::vector<Entry> entries;
+    Message message;
+
+    if (bucket_count == 1) {
+        protobuf::InFile messages(messages_in, protobuf::InFile::MMAP);
+        entries.reserve(message_count);
+        for (uint64_t pos = 0; messages.try_read_stream(message); ++pos) {
+            entries.push_back(Entry());
+            Entry & entry = entries.back();
+            entry.key = get_key(seed, pos);
+            entry.pos = pos;
+            std::swap(entry.message, message);
+        }
+        sort_and_write(entries, shuffled, thread_count);
+        return;
     }
-    std::shuffle(index.begin(), index.end(), loom::rng_t(seed));
 
-    Message message;
-    std::vector<Message> chunk;
-    protobuf::OutFile shuffled(shuffled_out);
-    for (size_t begin = 0; begin < message_count; begin += chunk_size) {
-        size_t end = std::min(begin + chunk_size, message_count);
-        chunk.resize(end - begin);
-        protobuf::InFile messages(messages_in);
-        for (size_t i : index) {
-            messages.try_read_stream(message);
-            if (begin <= i and i < end) {
-                std::swap(message, chunk[i - begin]);
+    // Scatter, with one reader per partition of a seekable input.
+    // An unindexed input is made seekable by the index built while counting,
+    // so no reader walks the messages before its partition.
+    const uint64_t bucket_width =
+        std::numeric_limits<uint64_t>::max() / bucket_count + 1;
+    const std::string temp_dir = make_temp_dir(shuffled_out);
+    std::vector<BucketFile> buckets(bucket_count);
+    for (size_t b = 0; b < bucket_count; ++b) {
+        buckets[b].open(temp_dir + "/" + std::to_string(b) + ".pbs");
+    }
+    size_t reader_count = 1;
+    {
+        protobuf::InFile messages(messages_in, protobuf::InFile::MMAP);
+        messages.set_index(index);
+        if (messages.is_seekable()) {
+            reader_count = std::min<uint64_t>(thread_count, message_count);
+            reader_count = std::max<size_t>(1, reader_count);
+        }
+    }
+    const size_t buffer_bytes = std::max(
+        4096.0,
+        target_mem_bytes / (2.0 * reader_count * bucket_count));
+
+    #pragma omp parallel for num_threads(reader_count) schedule(static, 1)
+    for (size_t r = 0; r < reader_count; ++r) {
+        const uint64_t begin = message_count * r / reader_count;
+        const uint64_t end = message_count * (r + 1) / reader_count;
+        std::vector<std::vector<char>> buffers(bucket_count);
+        std::vector<uint64_t> counts(bucket_count, 0);
+        Message message;
+        protobuf::InFile messages(messages_in, protobuf::InFile::MMAP);
+        messages.set_index(index);
+        messages.set_position(begin);
+        for (uint64_t pos = begin; pos < end; ++pos) {
+            bool success = messages.try_read_stream(message);
+            LOOM_ASSERT(success, "failed to read " << messages_in);
+            const size_t b = get_key(seed, pos) / bucket_width;
+            BucketFile::append_record(buffers[b], message, pos);
+            ++counts[b];
+            if (buffers[b].size() >= buffer_bytes) {
+                buckets[b].write(buffers[b], counts[b]);
             }
         }
-        for (const auto & message : chunk) {
-            shuffled.write_stream(message);
+        for (size_t b = 0; b < bucket_count; ++b) {
+            buckets[b].write(buffers[b], counts[b]);
         }
     }
+
+    // gather, with all bucket files closed to bound open descriptors
+    for (auto & bucket : buckets) {
+        bucket.close_file();
+    }
+    for (size_t b = 0; b < bucket_count; ++b) {
+        gather_bucket(
+            buckets[b],
+            b * bucket_width,
+            bucket_width,
+            seed,
+            target_mem_bytes,
+            shuffled,
+            thread_count);
+    }
+    rmdir(temp_dir.c_str());
 }
 
 } // namespace loom
@@ -0,0 +1,90 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/args.hpp>
+#include <loom/protobuf_stream.hpp>
+#include <loom/store.hpp>
+#include <loom/snapshot.hpp>
+
+const char * help_message =
+"Usage: snapshot MODEL_IN GROUPS_IN SNAPSHOT_OUT"
+"\nArguments:"
+"\n  MODEL_IN      filename of model (e.g. model.pb.gz)"
+"\n  GROUPS_IN     dirname containing per-kind group files"
+"\n  SNAPSHOT_OUT  filename of output snapshot (e.g. snapshot.bin)"
+"\nNotes:"
+"\n  Any input filename can end with .gz to indicate gzip compression."
+"\n  The snapshot is an uncompressed single-file copy of MODEL_IN and"
+"\n  GROUPS_IN; loading it still parses and rebuilds every group."
+"\n  The query server loads samples/sample.N/snapshot.bin if present"
+"\n  and its model and groups files are unchanged since snapshotting."
+;
+
+int main (int argc, char ** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    Args args(argc, argv, help_message);
+    const char * model_in = args.pop();
+    const char * groups_in = args.pop();
+    const char * snapshot_out = args.pop();
+    args.done();
+
+    // fingerprint before reading, so that sources changing meanwhile
+    // leave the snapshot stale rather than silently mixed
+    const uint64_t fingerprint =
+        loom::Snapshot::source_fingerprint(model_in, groups_in);
+    LOOM_ASSERT(fingerprint, "failed to stat " << model_in);
+
+    ::protobuf::loom::CrossCat model;
+    loom::protobuf::InFile(model_in).read(model);
+    const size_t kind_count = model.kinds_size();
+
+    std::vector<std::string> sections(
+        loom::Snapshot::groups_section(kind_count));
+    model.SerializeToString(
+        & sections[loom::Snapshot::model_section()]);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        std::string & section =
+            sections[loom::Snapshot::groups_section(kindid)];
+        const auto filename = loom::store::get_mixture_path(groups_in, kindid);
+        loom::protobuf::InFile groups(filename.c_str());
+        std::vector<char> raw;
+        while (groups.try_read_stream(raw)) {
+            const uint32_t size = raw.size();
+            section.append(reinterpret_cast<const char *>(& size), 4);
+            section.append(raw.data(), raw.size());
+        }
+    }
+
+    loom::Snapshot::dump(snapshot_out, sections, fingerprint);
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <loom/common.hpp>
+#include <loom/store.hpp>
+
+namespace loom
+{
+
+// A snapshot packs one sample's model and groups into a single
+// uncompressed file that is mapped and parsed in place, rather than
+// decompressed and opened file by file.  Loading still parses every group
+// and rebuilds every mixture, so it remains linear in the number of groups;
+// a snapshot saves only the decompression and per-file costs.  Scoring
+// straight from mapped group statistics is deliberately not supported,
+// since the distributions mixtures own their groups and score caches.
+//
+// The layout is a Header, a table of Sections, and then the sections
+// themselves, each aligned to a cache line:
+//
+//   section 0        the serialized protobuf::CrossCat model
+//   section 1 + k    kind k's stream of protobuf::ProductModel::Group
+//
+// Integers are stored in native (little endian) byte order.
+//
+// The header records a fingerprint of the source model and group files
+// (their sizes and nanosecond mtimes), so that a snapshot of stale
+// sources can be detected and ignored.
+class Snapshot : noncopyable
+{
+public:
+
+    enum { version = 2, alignment = 64 };
+
+    static size_t model_section () { return 0; }
+    static size_t groups_section (size_t kindid) { return 1 + kindid; }
+
+    explicit Snapshot (const char * filename) :
+        filename_(filename),
+        data_(nullptr),
+        size_(0)
+    {
+        int fid = open(filename, O_RDONLY);
+        LOOM_ASSERT(fid != -1, "failed to open snapshot " << filename);
+        struct stat info;
+        int status = fstat(fid, & info);
+        LOOM_ASSERT(status == 0, "failed to stat " << filename);
+        size_ = info.st_size;
+        LOOM_ASSERT_LE(sizeof(Header), size_);
+        void * data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fid, 0);
+        LOOM_ASSERT(data != MAP_FAILED, "failed to mmap " << filename);
+        close(fid);
+        madvise(data, size_, MADV_WILLNEED);
+        data_ = static_cast<const char *>(data);
+
+        const Header & header = _header();
+        LOOM_ASSERT(
+            memcmp(header.magic, magic(), sizeof(header.magic)) == 0,
+            "not a loom snapshot: " << filename);
+        LOOM_ASSERT(
+            header.version == version,
+            "unsupported snapshot version " << header.version <<
+            " in " << filename);
+        LOOM_ASSERT_LE(
+            sizeof(Header) + header.section_count * sizeof(Section),
+            size_);
+        for (size_t i = 0; i < header.section_count; ++i) {
+            const Section & section = _sections()[i];
+            LOOM_ASSERT(
+                section.offset % alignment == 0 and
+                section.offset + section.size <= size_,
+                "corrupt section " << i << " in " << filename);
+        }
+    }
+
+    ~Snapshot ()
+    {
+        munmap(const_cast<char *>(data_), size_);
+    }
+
+    const char * filename () const { return filename_.c_str(); }
+
+    size_t section_count () const { return _header().section_count; }
+
+    const char * section_data (size_t i) const
+    {
+        LOOM_ASSERT1(i < section_count(), "section out of range: " << i);
+        return data_ + _sections()[i].offset;
+    }
+
+    size_t section_size (size_t i) const
+    {
+        LOOM_ASSERT1(i < section_count(), "section out of range: " << i);
+        return _sections()[i].size;
+    }
+
+    // The fingerprint covers model_in and every mixture.K.pbs.gz file
+    // in groups_in, or is zero if model_in cannot be stat'ed.
+    static uint64_t source_fingerprint (
+            const char * model_in,
+            const char * groups_in)
+    {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        auto add = [&](uint64_t value){
+            for (size_t i = 0; i < 8; ++i) {
+                hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 1099511628211ULL;
+            }
+        };
+        auto add_file = [&](const char * filename){
+            struct stat info;
+            if (stat(filename, & info) != 0) {
+                return false;
+            }
+            add(info.st_size);
+            add(info.st_mtim.tv_sec);
+            add(info.st_mtim.tv_nsec);
+            return true;
+        };
+
+        if (not add_file(model_in)) {
+            return 0;
+        }
+        for (size_t kindid = 0;; ++kindid) {
+            const auto path = store::get_mixture_path(groups_in, kindid);
+            if (not add_file(path.c_str())) {
+                add(kindid);
+                break;
+            }
+        }
+        return hash;
+    }
+
+    // True iff filename is a readable snapshot of this version whose
+    // fingerprint matches the current model_in and groups_in.
+    static bool is_current (
+            const char * filename,
+            const char * model_in,
+            const char * groups_in)
+    {
+        Header header;
+        std::ifstream file(filename, std::ios::binary);
+        file.read(reinterpret_cast<char *>(& header), sizeof(Header));
+        return file and
+            memcmp(header.magic, magic(), sizeof(header.magic)) == 0 and
+            header.version == version and
+            header.source_fingerprint != 0 and
+            header.source_fingerprint ==
+                source_fingerprint(model_in, groups_in);
+    }
+
+    static void dump (
+            const char * filename,
+            const std::vector<std::string> & sections,
+            uint64_t source_fingerprint)
+    {
+        Header header;
+        memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = version;
+        header.section_count = sections.size();
+        header.source_fingerprint = source_fingerprint;
+
+        std::vector<Section> table(sections.size());
+        uint64_t offset = sizeof(Header) + table.size() * sizeof(Section);
+        for (size_t i = 0; i < sections.size(); ++i) {
+            offset = (offset + alignment - 1) / alignment * alignment;
+            table[i].offset = offset;
+            table[i].size = sections[i].size();
+            offset += sections[i].size();
+        }
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        LOOM_ASSERT(file, "failed to open output file " << filename);
+        file.write(reinterpret_cast<const char *>(& header), sizeof(Header));
+        file.write(
+            reinterpret_cast<const char *>(table.data()),
+            table.size() * sizeof(Section));
+        const char padding[alignment] = {0};
+        uint64_t pos = sizeof(Header) + table.size() * sizeof(Section);
+        for (size_t i = 0; i < sections.size(); ++i) {
+            file.write(padding, table[i].offset - pos);
+            file.write(sections[i].data(), sections[i].size());
+            pos = table[i].offset + table[i].size;
+        }
+        LOOM_ASSERT(file, "failed to write snapshot " << filename);
+    }
+
+private:
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t section_count;
+        uint64_t source_fingerprint;
+    };
+
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    static const char * magic () { return "LOOMSNAP"; }
+
+    const Header & _header () const
+    {
+        return * reinterpret_cast<const Header *>(data_);
+    }
+
+    const Section * _sections () const
+    {
+        return reinterpret_cast<const Section *>(data_ + sizeof(Header));
+    }
+
+    const std::string filename_;
+    const char * data_;
+    size_t size_;
+};
+
+} // namespace loom
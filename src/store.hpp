@@ -51,6 +51,7 @@ struct Paths
         std::string model;
         std::string groups;
         std::string assign;
+        std::string snapshot;
     };
 
     Ingest ingest;
@@ -89,6 +90,7 @@ inline Paths get_paths (const std::string & root)
             sample.model = sample_root + "/model.pb.gz";
             sample.groups = sample_root + "/groups";
             sample.assign = sample_root + "/assign.pbs.gz";
+            sample.snapshot = sample_root + "/snapshot.bin";
         } else {
             break;
         }
@@ -28,6 +28,10 @@
 
 #pragma once
 
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <loom/common.hpp>
 #include <loom/protobuf.hpp>
 #include <loom/assignments.hpp>
@@ -35,13 +39,185 @@
 namespace loom
 {
 
+// A cyclic cursor over a row stream.  With nonzero readahead_depth,
+// a worker thread reads ahead into a bounded ring of raw messages,
+// so that I/O stalls are absorbed before they reach the pipeline.
+class StreamCursor : noncopyable
+{
+public:
+
+    StreamCursor (const char * filename, size_t readahead_depth) :
+        file_(filename, readahead_depth ? 0 : protobuf::InFile::MMAP),
+        ring_(readahead_depth),
+        begin_(0),
+        end_(0),
+        position_(0),
+        running_(false),
+        stopping_(false),
+        skip_position_(0),
+        skipping_(false)
+    {
+    }
+
+    ~StreamCursor ()
+    {
+        _stop();
+    }
+
+    const char * filename () const { return file_.filename(); }
+    bool is_file () const { return file_.is_file(); }
+
+    uint64_t position () const
+    {
+        if (skipping_) {
+            return skip_position_;
+        } else {
+            return running_ ? position_ : file_.position();
+        }
+    }
+
+    void set_position (uint64_t position)
+    {
+        skipping_ = false;
+        _stop();
+        file_.set_position(position);
+    }
+
+    // Moves forward past rows without reading them,
+    // deferring any seek until the next read.
+    void skip_to (uint64_t position)
+    {
+        skip_position_ = position;
+        skipping_ = true;
+    }
+
+    void read (protobuf::RawMessage & raw)
+    {
+        _catch_up();
+        if (ring_.empty()) {
+            file_.cyclic_read_stream(raw);
+        } else {
+            _pop(raw);
+        }
+    }
+
+    template<class Message>
+    void read (Message & message)
+    {
+        _catch_up();
+        if (ring_.empty()) {
+            file_.cyclic_read_stream(message);
+        } else {
+            _pop(raw_);
+            bool success = message.ParseFromArray(raw_.data(), raw_.size());
+            LOOM_ASSERT(success, "failed to parse message from " << filename());
+        }
+    }
+
+private:
+
+    struct Slot
+    {
+        protobuf::RawMessage raw;
+        uint64_t position;
+    };
+
+    void _catch_up ()
+    {
+        if (LOOM_UNLIKELY(skipping_)) {
+            skipping_ = false;
+            if (running_) {
+                while (position_ != skip_position_) {
+                    _pop(raw_);
+                }
+            } else {
+                file_.set_position(skip_position_);
+            }
+        }
+    }
+
+    void _start ()
+    {
+        position_ = file_.position();
+        begin_ = 0;
+        end_ = 0;
+        stopping_ = false;
+        running_ = true;
+        worker_ = std::thread(& StreamCursor::_work, this);
+    }
+
+    void _stop ()
+    {
+        if (running_) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            cond_variable_.notify_all();
+            worker_.join();
+            running_ = false;
+        }
+    }
+
+    void _work ()
+    {
+        const size_t depth = ring_.size();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cond_variable_.wait(lock, [&]{
+                return stopping_ or end_ - begin_ < depth;
+            });
+            if (stopping_) {
+                break;
+            }
+            Slot & slot = ring_[end_ % depth];
+            lock.unlock();
+            file_.cyclic_read_stream(slot.raw);
+            slot.position = file_.position();
+            lock.lock();
+            ++end_;
+            cond_variable_.notify_all();
+        }
+    }
+
+    void _pop (protobuf::RawMessage & raw)
+    {
+        if (LOOM_UNLIKELY(not running_)) {
+            _start();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_variable_.wait(lock, [&]{ return begin_ != end_; });
+        Slot & slot = ring_[begin_ % ring_.size()];
+        lock.unlock();
+        raw.swap(slot.raw);
+        position_ = slot.position;
+        lock.lock();
+        ++begin_;
+        cond_variable_.notify_all();
+    }
+
+    protobuf::InFile file_;
+    std::vector<Slot> ring_;
+    uint64_t begin_;
+    uint64_t end_;
+    uint64_t position_;
+    bool running_;
+    bool stopping_;
+    std::mutex mutex_;
+    std::condition_variable cond_variable_;
+    std::thread worker_;
+    protobuf::RawMessage raw_;
+    uint64_t skip_position_;
+    bool skipping_;
+};
+
 class StreamInterval : noncopyable
 {
 public:
 
-    StreamInterval (const char * rows_in) :
-        unassigned_(rows_in),
-        assigned_(rows_in)
+    StreamInterval (const char * rows_in, size_t readahead_depth = 0) :
+        unassigned_(rows_in, readahead_depth),
+        assigned_(rows_in, readahead_depth)
     {
     }
 
@@ -63,68 +239,89 @@ public:
         rows.set_assigned_pos(assigned_.position());
     }
 
+    uint64_t unassigned_position () const { return unassigned_.position(); }
+    uint64_t assigned_position () const { return assigned_.position(); }
+
+    // removes a row whose content is already known, e.g. from a DiffCache
+    void skip_assigned (uint64_t position) { assigned_.skip_to(position); }
+
+    // This makes a single pass over row ids, peeking at each row's
+    // leading id field rather than parsing whole rows.
     void init_from_assignments (const Assignments & assignments)
     {
         LOOM_ASSERT(assignments.row_count(), "nothing to initialize");
         LOOM_ASSERT(assigned_.is_file(), "only files support StreamInterval");
 
-        #pragma omp parallel sections
-        {
-            #pragma omp section
-            seek_first_unassigned_row(assignments);
+        const auto first_assigned_rowid = assignments.rowids().front();
+        const auto last_assigned_rowid = assignments.rowids().back();
+        const uint64_t unknown = std::numeric_limits<uint64_t>::max();
+        uint64_t first_assigned_pos = unknown;
+        uint64_t last_assigned_pos = unknown;
 
-            #pragma omp section
-            seek_first_assigned_row(assignments);
+        protobuf::InFile peeker(assigned_.filename(), protobuf::InFile::MMAP);
+        protobuf::RawMessage raw;
+        while (first_assigned_pos == unknown or last_assigned_pos == unknown) {
+            const uint64_t pos = peeker.position();
+            bool success = peeker.try_read_stream(raw);
+            LOOM_ASSERT(success, "row.id not found: " <<
+                (first_assigned_pos == unknown
+                    ? first_assigned_rowid
+                    : last_assigned_rowid));
+            const uint64_t rowid = peek_rowid(raw);
+            if (rowid == first_assigned_rowid and
+                first_assigned_pos == unknown)
+            {
+                first_assigned_pos = pos;
+            }
+            if (rowid == last_assigned_rowid and
+                last_assigned_pos == unknown)
+            {
+                last_assigned_pos = pos;
+            }
         }
+
+        protobuf::Checkpoint::StreamInterval rows;
+        rows.set_unassigned_pos(last_assigned_pos + 1);
+        rows.set_assigned_pos(first_assigned_pos);
+        load(rows);
     }
 
     template<class Message>
     void read_unassigned (Message & message)
     {
-        unassigned_.cyclic_read_stream(message);
+        unassigned_.read(message);
     }
 
     template<class Message>
     void read_assigned (Message & message)
     {
-        assigned_.cyclic_read_stream(message);
+        assigned_.read(message);
     }
 
 private:
 
-    void seek_first_unassigned_row (const Assignments & assignments)
+    static uint64_t peek_rowid (const protobuf::RawMessage & raw)
     {
-        const auto last_assigned_rowid = assignments.rowids().back();
-        protobuf::Row row;
-
-        while (true) {
-            bool success = unassigned_.try_read_stream(row);
-            LOOM_ASSERT(success, "row.id not found: " << last_assigned_rowid);
-            if (row.id() == last_assigned_rowid) {
-                break;
-            }
+        google::protobuf::io::CodedInputStream coded(
+            reinterpret_cast<const google::protobuf::uint8 *>(raw.data()),
+            raw.size());
+        google::protobuf::uint64 rowid;
+        if (LOOM_LIKELY(coded.ReadTag() == row_id_tag and
+                        coded.ReadVarint64(& rowid))) {
+            return rowid;
+        } else {
+            protobuf::Row row;
+            bool success = row.ParseFromArray(raw.data(), raw.size());
+            LOOM_ASSERT(success, "failed to parse row");
+            return row.id();
         }
     }
 
-    void seek_first_assigned_row (const Assignments & assignments)
-    {
-        const auto first_assigned_rowid = assignments.rowids().front();
-        protobuf::InFile peeker(unassigned_.filename());
-        protobuf::Row row;
-        std::vector<char> unused;
-
-        while (true) {
-            bool success = peeker.try_read_stream(row);
-            LOOM_ASSERT(success, "row.id not found: " << first_assigned_rowid);
-            if (row.id() == first_assigned_rowid) {
-                break;
-            }
-            assigned_.try_read_stream(unused);
-        }
-    }
+    // field 1 (Row.id), wire type 0 (varint)
+    enum { row_id_tag = (1 << 3) | 0 };
 
-    protobuf::InFile unassigned_;
-    protobuf::InFile assigned_;
+    StreamCursor unassigned_;
+    StreamCursor assigned_;
 };
 
 } // namespace loom